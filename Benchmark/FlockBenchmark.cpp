@@ -0,0 +1,445 @@
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/Math/Random.h>
+#include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "../BoidSet.h"
+#include "../Flock.h"
+#include "../FlockRenderer.h"
+#include "../FlockSnapshot.h"
+#include "../FlockWorld.h"
+
+// Every heap allocation in the process goes through here so the step loop can be checked for churn
+static std::atomic<unsigned> allocationCount(0);
+
+void* operator new(size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (void* ptr = malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+// Physics step the game runs the flock at
+static const float TIME_STEP = 1.0f / 60.0f;
+// Largest flock -verify checks, the pass over every pair is quadratic
+static const unsigned VERIFY_MAX_BOIDS = 50000;
+// Largest force difference -verify accepts, relative to the force or to 1 for small forces.
+// The grid sums neighbours in another order, so the results only agree to rounding.
+static const double VERIFY_TOLERANCE = 1e-3;
+// Largest flock -snapshots measures, more would not fit the area snapshot positions cover at the default density
+static const unsigned SNAPSHOT_MAX_BOIDS = 100000;
+// Simulated time -snapshots lets the flocks form before measuring, then measures for
+static const float SNAPSHOT_SETTLE_TIME = 10.0f;
+static const float SNAPSHOT_MEASURE_TIME = 20.0f;
+// The game's default interest range, see -interestnear and -interestcutoff
+static const InterestRange SNAPSHOT_INTEREST = { 50.0f, 150.0f, 4 };
+
+struct BenchmarkResult
+{
+	unsigned numBoids;
+	unsigned ticks;
+	double nsPerBoidStep;
+	double instanceNsPerBoid;
+	double neighboursPerBoid;
+	double allocationsPerStep;
+	unsigned stateHash;
+	/// Largest grid against every pair force difference, negative when not checked.
+	double forceError;
+};
+
+struct SnapshotResult
+{
+	unsigned numBoids;
+	/// Snapshot bytes per second to one client at the centre, headers included.
+	double bytesPerSecond;
+	double bitsPerBoid;
+	/// The same with the game's default interest range.
+	double interestBytesPerSecond;
+	double interestBitsPerBoid;
+};
+
+static void PrintUsage()
+{
+	printf(
+		"Usage: FlockBenchmark [options]\n"
+		"  -boids <n>       Flock size to run, may be repeated. Default 1000, 10000, 100000, 1000000\n"
+		"  -ticks <n>       Timed steps per flock size. Default 20\n"
+		"  -threads <n>     Worker threads for the force phase, 0 to run on the main thread only. Default 0\n"
+		"  -kernel <name>   scalar or sse. Default sse when compiled in\n"
+		"  -nogrid          Test every pair instead of using the neighbour grid\n"
+		"  -species <n>     Split the boids into n flocks of different species that avoid each other. Default 1\n"
+		"  -density <d>     Boids per square unit of the starting area. Default 0.01\n"
+		"  -seed <n>        Random seed for the starting layout. Default 1\n"
+		"  -verify          Check the grid forces against testing every pair after the timed steps, up to 50000 boids\n"
+		"  -snapshots       Also measure the flock snapshot bytes a client is sent per second, up to 100000 boids\n"
+		"  -sendrate <n>    Snapshots sent per second for -snapshots. Default 10, as in the game\n"
+		"  -output <file>   Write the JSON report to a file instead of stdout\n");
+}
+
+static BenchmarkResult RunFlocks(FlockWorld& world, Flock* flocks, FlockRenderer** renderers, unsigned numFlocks, WorkQueue* queue,
+	unsigned numBoids, unsigned ticks, float density, bool verify)
+{
+	// Keep the density fixed so neighbour counts are comparable across sizes
+	float halfSize = 0.5f * Sqrt(numBoids / density);
+	for (unsigned f = 0; f < numFlocks; f++)
+	{
+		Flock& flock = flocks[f];
+		// The first flock takes the remainder
+		unsigned count = numBoids / numFlocks + (f == 0 ? numBoids % numFlocks : 0);
+		flock.Resize(count);
+		for (unsigned i = 0; i < count; i++)
+		{
+			flock.position[i] = Vector3(Random(-halfSize, halfSize), 1.5f, Random(-halfSize, halfSize));
+			flock.velocity[i] = Vector3(Random(-10.0f, 10.0f), 0.0f, Random(-10.0f, 10.0f));
+			flock.force[i] = Vector3::ZERO;
+			flock.alive[i] = true;
+		}
+	}
+
+	// One untimed step sizes the grid, packed arrays and instance buffers
+	world.ComputeForces(queue);
+	for (unsigned f = 0; f < numFlocks; f++)
+	{
+		flocks[f].Integrate(TIME_STEP);
+		renderers[f]->SetInstances(flocks[f]);
+	}
+
+	unsigned allocationsBefore = allocationCount.load();
+	unsigned long long neighbours = 0;
+	long long elapsed = 0;
+	long long instanceElapsed = 0;
+	HiresTimer timer;
+	for (unsigned t = 0; t < ticks; t++)
+	{
+		timer.Reset();
+		world.ComputeForces(queue);
+		for (unsigned f = 0; f < numFlocks; f++)
+			flocks[f].Integrate(TIME_STEP);
+		elapsed += timer.GetUSec(true);
+		for (unsigned f = 0; f < numFlocks; f++)
+			renderers[f]->SetInstances(flocks[f]);
+		instanceElapsed += timer.GetUSec(false);
+		for (unsigned f = 0; f < numFlocks; f++)
+			neighbours += flocks[f].GetNumNeighboursVisited();
+	}
+	unsigned allocations = allocationCount.load() - allocationsBefore;
+
+	BenchmarkResult result;
+	result.numBoids = numBoids;
+	result.ticks = ticks;
+	result.nsPerBoidStep = elapsed * 1000.0 / ((double)numBoids * ticks);
+	result.instanceNsPerBoid = instanceElapsed * 1000.0 / ((double)numBoids * ticks);
+	result.neighboursPerBoid = (double)neighbours / ((double)numBoids * ticks);
+	result.allocationsPerStep = (double)allocations / ticks;
+	// Same seed, same hash, on any thread count. A kernel change that moves it changed the flight
+	result.stateHash = world.GetStateHash();
+
+	// Forces only depend on the state, so both passes see the same boids
+	result.forceError = -1.0;
+	if (verify && numBoids <= VERIFY_MAX_BOIDS)
+	{
+		PODVector<Vector3> gridForces;
+		bool useGrid = world.useGrid;
+		world.useGrid = true;
+		world.ComputeForces(queue);
+		for (unsigned f = 0; f < numFlocks; f++)
+			gridForces.Push(flocks[f].force);
+
+		world.useGrid = false;
+		world.ComputeForces(queue);
+		world.useGrid = useGrid;
+
+		result.forceError = 0.0;
+		unsigned g = 0;
+		for (unsigned f = 0; f < numFlocks; f++)
+		{
+			for (unsigned i = 0; i < flocks[f].GetNumBoids(); i++, g++)
+			{
+				const Vector3& exact = flocks[f].force[i];
+				double error = (gridForces[g] - exact).Length() / Max(exact.Length(), 1.0f);
+				result.forceError = Max(result.forceError, error);
+			}
+		}
+	}
+	return result;
+}
+
+static SnapshotResult RunSnapshots(Scene* scene, FlockKernel kernel, unsigned numFlocks, WorkQueue* queue, unsigned numBoids,
+	float density, unsigned sendRate)
+{
+	// Laid out like RunFlocks, but as the game's kinematic BoidSets so the sender sees the same pools
+	float halfSize = 0.5f * Sqrt(numBoids / density);
+	Vector<SharedPtr<BoidSet> > sets;
+	FlockWorld world;
+	for (unsigned f = 0; f < numFlocks; f++)
+	{
+		unsigned count = numBoids / numFlocks + (f == 0 ? numBoids % numFlocks : 0);
+		SharedPtr<BoidSet> set(new BoidSet());
+		set->Initialise(scene->GetSubsystem<ResourceCache>(), scene, count, 0, true, f + 1);
+		set->isActive = true;
+		set->flock.kernel = kernel;
+		set->flock.species = f;
+		for (unsigned i = 0; i < count; i++)
+		{
+			set->Spawn(Vector3(Random(-halfSize, halfSize), 1.5f, Random(-halfSize, halfSize)));
+			set->flock.velocity[i] = Vector3(Random(-10.0f, 10.0f), 0.0f, Random(-10.0f, 10.0f));
+		}
+		sets.Push(set);
+		world.AddFlock(&set->flock);
+		for (unsigned o = 0; o < numFlocks; o++)
+		{
+			if (o != f)
+				world.SetInteraction(f, o, 0.0f, 1.0f);
+		}
+	}
+
+	// Both clients watch the same flight
+	FlockSnapshotSender sender;
+	sender.Initialise(sets);
+	FlockSnapshotSender interestSender;
+	interestSender.Initialise(sets);
+	interestSender.SetInterest(SNAPSHOT_INTEREST);
+
+	unsigned long long bytes = 0;
+	unsigned long long interestBytes = 0;
+	unsigned sends = 0;
+	float time = 0.0f;
+	float sendTime = 0.0f;
+	float sendInterval = 1.0f / sendRate;
+	while (time < SNAPSHOT_SETTLE_TIME + SNAPSHOT_MEASURE_TIME)
+	{
+		for (unsigned f = 0; f < numFlocks; f++)
+			sets[f]->Gather();
+		world.ComputeForces(queue);
+		for (unsigned f = 0; f < numFlocks; f++)
+			sets[f]->Update(TIME_STEP);
+		time += TIME_STEP;
+
+		sendTime += TIME_STEP;
+		if (sendTime < sendInterval)
+			continue;
+		sendTime -= sendInterval;
+		unsigned sent = sender.MeasureSend(Vector3::ZERO, time);
+		unsigned interestSent = interestSender.MeasureSend(Vector3::ZERO, time);
+		if (time >= SNAPSHOT_SETTLE_TIME)
+		{
+			bytes += sent;
+			interestBytes += interestSent;
+			++sends;
+		}
+	}
+
+	for (unsigned f = 0; f < numFlocks; f++)
+		sets[f]->pNode->Remove();
+
+	SnapshotResult result;
+	result.numBoids = numBoids;
+	double seconds = (double)Max(sends, 1U) / sendRate;
+	result.bytesPerSecond = bytes / seconds;
+	result.interestBytesPerSecond = interestBytes / seconds;
+	result.bitsPerBoid = bytes * 8.0 / ((double)numBoids * Max(sends, 1U));
+	result.interestBitsPerBoid = interestBytes * 8.0 / ((double)numBoids * Max(sends, 1U));
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	const Vector<String>& arguments = ParseArguments(argc, argv);
+
+	PODVector<unsigned> sizes;
+	unsigned ticks = 20;
+	unsigned threads = 0;
+	float density = 0.01f;
+	unsigned seed = 1;
+	unsigned numSpecies = 1;
+	bool useGrid = true;
+	bool verify = false;
+	bool snapshots = false;
+	unsigned sendRate = 10;
+	FlockKernel kernel = Flock::IsKernelSupported(FLOCK_KERNEL_SSE) ? FLOCK_KERNEL_SSE : FLOCK_KERNEL_SCALAR;
+	String outputName;
+
+	for (unsigned i = 0; i < arguments.Size(); i++)
+	{
+		String argument = arguments[i].ToLower();
+		String value = i + 1 < arguments.Size() ? arguments[i + 1] : String::EMPTY;
+
+		if (argument == "-boids" && !value.Empty())
+		{
+			sizes.Push(ToUInt(value));
+			++i;
+		}
+		else if (argument == "-ticks" && !value.Empty())
+		{
+			ticks = Max(ToUInt(value), 1U);
+			++i;
+		}
+		else if (argument == "-threads" && !value.Empty())
+		{
+			threads = ToUInt(value);
+			++i;
+		}
+		else if (argument == "-kernel" && !value.Empty())
+		{
+			kernel = value.ToLower() == "scalar" ? FLOCK_KERNEL_SCALAR : FLOCK_KERNEL_SSE;
+			++i;
+		}
+		else if (argument == "-density" && !value.Empty())
+		{
+			density = Max(ToFloat(value), M_EPSILON);
+			++i;
+		}
+		else if (argument == "-seed" && !value.Empty())
+		{
+			seed = ToUInt(value);
+			++i;
+		}
+		else if (argument == "-species" && !value.Empty())
+		{
+			numSpecies = Clamp(ToUInt(value), 1U, MAX_FLOCK_SPECIES);
+			++i;
+		}
+		else if (argument == "-sendrate" && !value.Empty())
+		{
+			sendRate = Max(ToUInt(value), 1U);
+			++i;
+		}
+		else if (argument == "-output" && !value.Empty())
+		{
+			outputName = value;
+			++i;
+		}
+		else if (argument == "-nogrid")
+			useGrid = false;
+		else if (argument == "-verify")
+			verify = true;
+		else if (argument == "-snapshots")
+			snapshots = true;
+		else
+		{
+			PrintUsage();
+			return argument == "-h" || argument == "-help" ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!Flock::IsKernelSupported(kernel))
+	{
+		fprintf(stderr, "Requested kernel is not compiled in, using scalar\n");
+		kernel = FLOCK_KERNEL_SCALAR;
+	}
+
+	if (sizes.Empty())
+	{
+		sizes.Push(1000);
+		sizes.Push(10000);
+		sizes.Push(100000);
+		sizes.Push(1000000);
+	}
+
+	SharedPtr<Context> context(new Context());
+	// Time sets up the high resolution timer frequency
+	context->RegisterSubsystem(new Time(context));
+	WorkQueue* queue = new WorkQueue(context);
+	context->RegisterSubsystem(queue);
+	if (threads)
+		queue->CreateThreads(threads);
+	// BoidSets look up their model, which fails quietly without the game's resources as nothing is drawn
+	context->RegisterSubsystem(new ResourceCache(context));
+
+	SetRandomSeed(seed);
+
+	// The renderer is timed filling its instance buffer, nothing is drawn
+	FlockRenderer::RegisterObject(context);
+	SharedPtr<Scene> scene(new Scene(context));
+	PODVector<FlockRenderer*> renderers;
+	for (unsigned f = 0; f < numSpecies; f++)
+		renderers.Push(scene->CreateChild("Flock")->CreateComponent<FlockRenderer>());
+
+	PODVector<BenchmarkResult> results;
+	for (unsigned i = 0; i < sizes.Size(); i++)
+	{
+		// Like the game, every flock is its own species and only avoids the others
+		Flock flocks[MAX_FLOCK_SPECIES];
+		FlockWorld world;
+		world.useGrid = useGrid;
+		for (unsigned f = 0; f < numSpecies; f++)
+		{
+			flocks[f].kernel = kernel;
+			flocks[f].species = f;
+			world.AddFlock(&flocks[f]);
+			for (unsigned o = 0; o < numSpecies; o++)
+			{
+				if (o != f)
+					world.SetInteraction(f, o, 0.0f, 1.0f);
+			}
+		}
+		results.Push(RunFlocks(world, flocks, &renderers[0], numSpecies, queue, sizes[i], ticks, density, verify));
+	}
+
+	PODVector<SnapshotResult> snapshotResults;
+	for (unsigned i = 0; i < sizes.Size() && snapshots; i++)
+	{
+		if (sizes[i] <= SNAPSHOT_MAX_BOIDS)
+			snapshotResults.Push(RunSnapshots(scene, kernel, numSpecies, queue, sizes[i], density, sendRate));
+	}
+
+	String report;
+	report.AppendWithFormat("{\n  \"kernel\": \"%s\",\n  \"grid\": %s,\n  \"threads\": %u,\n  \"density\": %g,\n  \"seed\": %u,\n  \"species\": %u,\n  \"results\": [\n",
+		kernel == FLOCK_KERNEL_SSE ? "sse" : "scalar", useGrid ? "true" : "false", threads, density, seed, numSpecies);
+	bool verified = true;
+	for (unsigned i = 0; i < results.Size(); i++)
+	{
+		const BenchmarkResult& r = results[i];
+		String forceError = r.forceError < 0.0 ? String("null") : String(r.forceError);
+		report.AppendWithFormat("    { \"boids\": %u, \"ticks\": %u, \"nsPerBoidStep\": %.3f, \"instanceNsPerBoid\": %.3f, \"neighboursPerBoid\": %.3f, \"allocationsPerStep\": %.3f, \"stateHash\": \"%08x\", \"forceError\": %s }%s\n",
+			r.numBoids, r.ticks, r.nsPerBoidStep, r.instanceNsPerBoid, r.neighboursPerBoid, r.allocationsPerStep, r.stateHash, forceError.CString(), i + 1 < results.Size() ? "," : "");
+		if (r.forceError > VERIFY_TOLERANCE)
+		{
+			fprintf(stderr, "%u boids: grid forces differ from every pair by %g\n", r.numBoids, r.forceError);
+			verified = false;
+		}
+	}
+	report += "  ]";
+	if (snapshots)
+	{
+		report.AppendWithFormat(",\n  \"sendRate\": %u,\n  \"snapshots\": [\n", sendRate);
+		for (unsigned i = 0; i < snapshotResults.Size(); i++)
+		{
+			const SnapshotResult& r = snapshotResults[i];
+			report.AppendWithFormat("    { \"boids\": %u, \"bytesPerSecond\": %.0f, \"bitsPerBoid\": %.2f, \"interestBytesPerSecond\": %.0f, \"interestBitsPerBoid\": %.2f }%s\n",
+				r.numBoids, r.bytesPerSecond, r.bitsPerBoid, r.interestBytesPerSecond, r.interestBitsPerBoid, i + 1 < snapshotResults.Size() ? "," : "");
+		}
+		report += "  ]";
+	}
+	report += "\n}\n";
+
+	if (outputName.Empty())
+		PrintUnicode(report);
+	else
+	{
+		File file(context, outputName, FILE_WRITE);
+		if (!file.IsOpen())
+		{
+			fprintf(stderr, "Could not open %s for writing\n", outputName.CString());
+			return EXIT_FAILURE;
+		}
+		file.Write(report.CString(), report.Length());
+	}
+
+	return verified ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,21 +1,11 @@
 #include "Boid.h"
-
-float Boid::Range_FAttract = 60.0f;
-float Boid::Range_FRepel = 40.0f;
-float Boid::Range_FAlign = 10.0f;
-
-float Boid::FAttract_Vmax = 5.0f;
-
-float Boid::FAttract_Factor = 8.0f;
-float Boid::FRepel_Factor = 8.0f;
-float Boid::FAlign_Factor = 4.0f;
-
+#include "CollisionTags.h"
+#include "Flock.h"
 
 Boid::Boid() {
 	pNode = nullptr;
 	pRigidBody = nullptr;
 	pCollisionShape = nullptr;
-	pObject = nullptr;
 	isDead = false;
 };
 
@@ -23,223 +13,83 @@ Boid::~Boid()
 {
 }
 
-void Boid::Initialise(ResourceCache* pRes, Scene* pScene)
+void Boid::Initialise(Node* pParent, bool kinematic)
 {
-	pNode = pScene->CreateChild("Boid");
-	pRigidBody = pNode->CreateComponent<RigidBody>();
-	pCollisionShape = pNode->CreateComponent<CollisionShape>();
-	pCollisionShape->SetSphere(0.5F);
-	//pRigidBody->SetTrigger(true);
-	pObject = pNode->CreateComponent<StaticModel>();
-
-	pObject->SetModel(pRes->GetResource<Model>("Models/ptewing.mdl"));
-	pObject->SetMaterial(pRes->GetResource<Material>("Materials/Stone.xml"));
-
-	pRigidBody->SetMass(1.0f);
-	pRigidBody->SetUseGravity(false);
-	pRigidBody->SetPosition(Vector3(Random(180.0f) - 90.0f, 1.5f , Random(180.0f) - 90.0f));
+	Node* node = pParent->CreateChild("Boid");
+	node->SetEnabled(false);
+	SetupNode(node, kinematic);
+	Attach(node);
 }
 
-void Boid::ComputeForce(Boid* pBoidList, int numOfBoids)
+void Boid::SetupNode(Node* node, bool kinematic)
 {
-	if (pRigidBody->GetUseGravity()) {
-		isDead = true;
-		pRigidBody->SetUseGravity(false);
-		pRigidBody->SetPosition(Vector3(0, -100, 0));
-	}
+	if (kinematic)
+		return;
 
-	force = Vector3(0, 0, 0);
-	if (!isDead) {
-		//force += Attraction(pBoidList, numOfBoids);
-		//force += Seperation(pBoidList, numOfBoids);
-		//force += Allign(pBoidList, numOfBoids);
-		force = BoidMasterCal(pBoidList, numOfBoids);
-		force += AttractionCeneter(pBoidList, numOfBoids);
+	RigidBody* body = node->CreateComponent<RigidBody>();
+	SetCollisionKind(body, COLLISION_BOID);
+	CollisionShape* shape = node->CreateComponent<CollisionShape>();
+	shape->SetSphere(radius * 2.0f);
+	//body->SetTrigger(true);
 
-		force *= Vector3(1, 0, 1);
-	}
+	body->SetMass(1.0f);
+	body->SetUseGravity(false);
 }
 
-Vector3 Boid::Attraction(Boid* pBoidList, int numOfBoids)
+void Boid::Attach(Node* node)
 {
-	Vector3 fA = Vector3(0, 0, 0);
-
-	Vector3 CoM; //centre of mass, accumulated total	
-	int n = 0;   //count number of neigbours
-				 //set the force member variable to zero force =Vector3(0, 0, 0);
-				 //Search Neighbourhood
-	for (int i = 0; i < numOfBoids; i++)
-	{
-		//the current boid?
-		if (this == &pBoidList[i] || pBoidList[i].isDead)
-			continue;
-		//sep = vector position of this boid from current oid
-		Vector3 sep = pRigidBody->GetPosition() - pBoidList[i].pRigidBody->GetPosition();
-		float d = sep.Length();
-		//distance of boid 
-		if (d < Range_FAttract)
-		{
-			//with range, so is a neighbour
-			CoM += pBoidList[i].pRigidBody->GetPosition();
-			n++;
-		}
-	}
-	//Attractive force component
-	if (n > 0)
-	{
-		//find average position = centre of mass
-		CoM /= n;
-		Vector3 dir = (CoM - pRigidBody->GetPosition()).Normalized();
-		Vector3 vDesired = dir * FAttract_Vmax;
-		fA += (vDesired - pRigidBody->GetLinearVelocity()) * FAttract_Factor;
-	}
-
-	return fA;
+	pNode = node;
+	pRigidBody = node->GetComponent<RigidBody>();
+	pCollisionShape = node->GetComponent<CollisionShape>();
+	Despawn();
 }
 
-Vector3 Boid::AttractionCeneter(Boid* pBoidList, int numOfBoids)
+void Boid::Spawn(const Vector3& position)
 {
-	Vector3 fA = Vector3(0, 0, 0);
-
-	Vector3 CoM; //centre of mass, accumulated total	
-	int n = 0;   //count number of neigbours
-				 //set the force member variable to zero force =Vector3(0, 0, 0);
-				 //Search Neighbourhood
-	for (int i = 0; i < numOfBoids; i++)
-	{
-		//the current boid?
-		if (this == &pBoidList[i] || pBoidList[i].isDead)
-			continue;
-		//sep = vector position of this boid from current oid
-		Vector3 sep = pRigidBody->GetPosition() - Vector3(0, 0, 0);
-		float d = sep.Length();
-		//distance of boid 
-		if (d < 10.0f)
-		{
-			//with range, so is a neighbour
-			CoM += pBoidList[i].pRigidBody->GetPosition();
-			n++;
-		}
-	}
-	//Attractive force component
-	if (n > 0)
-	{
-		//find average position = centre of mass
-		CoM /= n;
-		Vector3 dir = (CoM - pRigidBody->GetPosition()).Normalized();
-		Vector3 vDesired = dir * FAttract_Vmax;
-		fA += (vDesired - pRigidBody->GetLinearVelocity()) * FAttract_Factor;
+	isDead = false;
+	pNode->SetEnabled(true);
+	if (!pRigidBody) {
+		pNode->SetPosition(position);
+		return;
 	}
-
-	return fA;
+	pRigidBody->SetUseGravity(false);
+	pRigidBody->SetPosition(position);
+	pRigidBody->SetLinearVelocity(Vector3::ZERO);
 }
 
-Vector3 Boid::Seperation(Boid* pBoidList, int numOfBoids)
+void Boid::Despawn()
 {
-	Vector3 fS = Vector3(0, 0, 0);
-	Vector3 diff = Vector3();
-
-	int n = 0;
-
-	for (int i = 0; i < numOfBoids; i++)
-	{
-		if (this == &pBoidList[i] || pBoidList[i].isDead)
-			continue;
-		Vector3 dist = pRigidBody->GetPosition() - pBoidList[i].pRigidBody->GetPosition();
-		float d = dist.Length();
-		if (d < Range_FRepel) {
-			diff += dist.Normalized();
-			//n++;
-		}
-	}
-
-	fS = diff * FRepel_Factor;
-
-	return fS;
+	// A disabled node takes its body out of the physics world and out of the flock renderer on clients
+	isDead = true;
+	pNode->SetEnabled(false);
 }
 
-Vector3 Boid::Allign(Boid* pBoidList, int numOfBoids)
+void Boid::Kill()
 {
-	Vector3 fA = Vector3(0, 0, 0);
-	Vector3 direction = Vector3(0, 0, 0);
-
-	int n = 0;
-
-	for (int i = 0; i < numOfBoids; i++)
-	{
-		if (this == &pBoidList[i] || pBoidList[i].isDead)
-			continue;
-		Vector3 dist = pRigidBody->GetPosition() - pBoidList[i].pRigidBody->GetPosition();
-		float d = dist.Length();
-		if (d < Range_FAlign) {
-			direction += pBoidList[i].pRigidBody->GetLinearVelocity();
-			n++;
-		}
-	}
-
-	if (n > 0)
-	{
-		//find average position = centre of mass
-		direction /= n;
-
-		fA += (direction - pRigidBody->GetLinearVelocity()) * FAlign_Factor;
+	isDead = true;
+	if (pRigidBody) {
+		pRigidBody->SetLinearVelocity(Vector3::ZERO);
+		pRigidBody->SetPosition(Vector3(0, -100, 0));
+		return;
 	}
-
-	return fA;
+	pNode->SetPosition(Vector3(0, -100, 0));
 }
 
-Vector3 Boid::BoidMasterCal(Boid* pBoidList, int numOfBoids)
+void Boid::Place(const Vector3& position, const Vector3& velocity)
 {
-	Vector3 fA = Vector3(0, 0, 0);
-	Vector3 diff = Vector3();
-	Vector3 direction = Vector3();
-
-	Vector3 CoM; //centre of mass, accumulated total	
-	int n = 0;   //count number of neigbours
-				 //set the force member variable to zero force =Vector3(0, 0, 0);
-				 //Search Neighbourhood
-	for (int i = 0; i < numOfBoids; i++)
-	{
-		//the current boid?
-		if (this == &pBoidList[i] || pBoidList[i].isDead)
-			continue;
-		//sep = vector position of this boid from current oid
-		Vector3 sep = pRigidBody->GetPosition() - pBoidList[i].pRigidBody->GetPosition();
-		float d = sep.Length();
-		//distance of boid 
-		if (d < Range_FAttract)
-		{
-			//with range, so is a neighbour
-			CoM += pBoidList[i].pRigidBody->GetPosition();
-			n++;
-		}
-		if (d < Range_FRepel)
-			diff += sep.Normalized();
-		if (d < Range_FAlign) {
-			direction += pBoidList[i].pRigidBody->GetLinearVelocity();
-		}
-	}
-	//Attractive force component
-	if (n > 0)
-	{
-		//find average position = centre of mass
-		CoM /= n;
-		Vector3 dir = (CoM - pRigidBody->GetPosition()).Normalized();
-		Vector3 vDesired = dir * FAttract_Vmax;
-		fA += (vDesired - pRigidBody->GetLinearVelocity()) * FAttract_Factor;
-		direction /= n;
-	}
-
-	diff *= FRepel_Factor;
-	direction = (direction - pRigidBody->GetLinearVelocity())* FAlign_Factor;
+	pNode->SetTransform(position, Flock::GetHeading(velocity));
+}
 
-	return fA + diff + direction;
+void Boid::ReadState(Vector3& position, Vector3& velocity)
+{
+	position = pRigidBody->GetPosition();
+	velocity = pRigidBody->GetLinearVelocity();
 }
 
-void Boid::Update(float tm)
+void Boid::Update(const Vector3& force, const Vector3& position, const Vector3& velocity, float tm)
 {
 	pRigidBody->ApplyForce(force);
-	Vector3 vel = pRigidBody->GetLinearVelocity();
+	Vector3 vel = velocity;
 	float d = vel.Length();
 	if (d < 10.0f)
 	{
@@ -257,7 +107,7 @@ void Boid::Update(float tm)
 		Vector3 cp = -vn.CrossProduct(Vector3(0.0f, 1.0f, 0.0f));
 		float dp = cp.DotProduct(vn);
 		pRigidBody->SetRotation(Quaternion(Acos(dp), cp));
-		Vector3 p = pRigidBody->GetPosition();
+		Vector3 p = position;
 		if (p.y_ < 1.4f)
 		{
 			p.y_ = 1.5f;
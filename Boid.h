@@ -32,33 +32,37 @@ namespace Urho3D
 
 using namespace Urho3D;
 
+// Scene side of a single boid. Simulation state lives in Flock, this only holds the components
+// that are read from and written back to once per step.
 class Boid {
-	static float Range_FAttract; 
-	static float Range_FRepel; 
-	static float Range_FAlign; 
-	static float FAttract_Factor; 
-	static float FRepel_Factor; 
-	static float FAlign_Factor; 
-	static float FAttract_Vmax;
-	Vector3 force;
 public:
+	// Collision sphere radius. CollisionShape::SetSphere takes the diameter
+	static constexpr float radius = 0.25f;
 
 	bool isDead;
 	Node *pNode;
 	RigidBody *pRigidBody;
 	CollisionShape *pCollisionShape;
-	StaticModel *pObject;
 
 	Boid();
 
 	~Boid();
 
-	void Initialise(ResourceCache *pRes, Scene *pScene);
-	void ComputeForce(Boid *pBoid, int numOfBoids);
-	Vector3 Attraction(Boid* pBoidList, int numOfBoids);
-	Vector3 AttractionCeneter(Boid* pBoidList, int numOfBoids);
-	Vector3 Seperation(Boid* pBoidList, int numOfBoids);
-	Vector3 Allign(Boid* pBoidList, int numOfBoids);
-	Vector3 BoidMasterCal(Boid* pBoidList, int numOfBoids);
-	void Update(float tm);
+	// Create the node under the flock's node, which draws it. Kinematic boids get no physics components.
+	// The boid starts out despawned.
+	void Initialise(Node *pParent, bool kinematic);
+	// Add a boid's components to a node, usually a Prefab template that is then cloned for a whole flock
+	static void SetupNode(Node *pNode, bool kinematic);
+	// Take over a node set up by SetupNode. The boid starts out despawned.
+	void Attach(Node *pNode);
+	void Spawn(const Vector3& position);
+	void Despawn();
+	// Mark a boid as shot and move it out of sight
+	void Kill();
+	// Set a kinematic boid's node from the flock state
+	void Place(const Vector3& position, const Vector3& velocity);
+	// Copy the body state out for the flock step
+	void ReadState(Vector3& position, Vector3& velocity);
+	// Write the flock step result back to the body
+	void Update(const Vector3& force, const Vector3& position, const Vector3& velocity, float tm);
 };
\ No newline at end of file
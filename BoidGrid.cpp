@@ -0,0 +1,105 @@
+#include "BoidGrid.h"
+
+// Upper bound on cells per entry, so a few far-flung boids can't blow up the cell table
+static const unsigned MAX_CELLS_PER_ENTRY = 4;
+static const unsigned MIN_CELLS = 64;
+
+BoidGrid::BoidGrid()
+{
+	cellSize = 10.0f;
+	invCellSize = 1.0f / cellSize;
+	minX = 0.0f;
+	minZ = 0.0f;
+	width = 1;
+	height = 1;
+}
+
+void BoidGrid::SetCellSize(float size)
+{
+	cellSize = Max(size, M_EPSILON);
+}
+
+void BoidGrid::Build(const Vector3* positions, const bool* alive, unsigned count)
+{
+	entries.Clear();
+	entryCell.Resize(count);
+
+	float maxX = -M_INFINITY;
+	float maxZ = -M_INFINITY;
+	minX = M_INFINITY;
+	minZ = M_INFINITY;
+	unsigned numAlive = 0;
+	for (unsigned i = 0; i < count; ++i)
+	{
+		if (alive && !alive[i])
+			continue;
+		++numAlive;
+		// A NaN or infinite position would make the bounds unusable, it is still binned into an edge cell
+		const Vector3& p = positions[i];
+		if (!(Abs(p.x_) < M_INFINITY && Abs(p.z_) < M_INFINITY))
+			continue;
+		minX = Min(minX, p.x_);
+		minZ = Min(minZ, p.z_);
+		maxX = Max(maxX, p.x_);
+		maxZ = Max(maxZ, p.z_);
+	}
+
+	if (minX > maxX)
+		minX = maxX = minZ = maxZ = 0.0f;
+
+	if (!numAlive)
+	{
+		width = 1;
+		height = 1;
+		cellStart.Resize(2);
+		cellStart[0] = cellStart[1] = 0;
+		return;
+	}
+
+	// Grow the cells if the flock is spread too thin for the requested size
+	float size = cellSize;
+	unsigned maxCells = Max(numAlive * MAX_CELLS_PER_ENTRY, MIN_CELLS);
+	// Sized in float, so a far-flung boid can't overflow the cast
+	for (;;)
+	{
+		float cellsX = Floor((maxX - minX) / size) + 1.0f;
+		float cellsZ = Floor((maxZ - minZ) / size) + 1.0f;
+		if (cellsX * cellsZ <= (float)maxCells)
+		{
+			width = (int)cellsX;
+			height = (int)cellsZ;
+			break;
+		}
+		size *= 2.0f;
+	}
+	invCellSize = 1.0f / size;
+
+	// Counting sort by cell. Walking the input backwards leaves each cell in ascending index order.
+	unsigned numCells = (unsigned)(width * height);
+	cellStart.Resize(numCells + 1);
+	for (unsigned c = 0; c <= numCells; ++c)
+		cellStart[c] = 0;
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		if (alive && !alive[i])
+		{
+			entryCell[i] = M_MAX_UNSIGNED;
+			continue;
+		}
+		unsigned c = (unsigned)(CellZ(positions[i].z_) * width + CellX(positions[i].x_));
+		entryCell[i] = c;
+		++cellStart[c];
+	}
+
+	for (unsigned c = 1; c <= numCells; ++c)
+		cellStart[c] += cellStart[c - 1];
+
+	entries.Resize(numAlive);
+	for (unsigned i = count; i-- > 0;)
+	{
+		unsigned c = entryCell[i];
+		if (c != M_MAX_UNSIGNED)
+			entries[--cellStart[c]] = i;
+	}
+}
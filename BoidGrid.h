@@ -0,0 +1,74 @@
+#pragma once
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/MathDefs.h>
+#include <Urho3D/Math/Vector3.h>
+
+using namespace Urho3D;
+
+/// Uniform grid over the XZ plane used to limit boid neighbour searches to nearby cells.
+/// The grid bounds follow the data, so it is rebuilt from scratch every flock step.
+class BoidGrid
+{
+public:
+	BoidGrid();
+
+	/// Set the cell edge length. Queries visit every cell overlapping their radius.
+	void SetCellSize(float size);
+	float GetCellSize() const { return cellSize; }
+
+	/// Bin positions[0..count) by cell. Entries whose alive flag is false are left out.
+	void Build(const Vector3* positions, const bool* alive, unsigned count);
+
+	/// Call func(index) for every binned entry in the cells overlapping the circle (centre, radius).
+	/// Candidates are not distance tested, that is left to the caller.
+	template <class F> void ForEachCandidate(const Vector3& centre, float radius, F func) const
+	{
+		ForEachCandidateRun(centre, radius, [&](unsigned begin, unsigned end) {
+			for (unsigned e = begin; e < end; ++e)
+				func(entries[e]);
+		});
+	}
+
+	/// Call func(begin, end) for each run of sorted entries covering the circle (centre, radius).
+	/// Cells of a row are contiguous, so there is one run per row of cells.
+	template <class F> void ForEachCandidateRun(const Vector3& centre, float radius, F func) const
+	{
+		if (entries.Empty())
+			return;
+
+		int x0 = CellX(centre.x_ - radius);
+		int x1 = CellX(centre.x_ + radius);
+		int z0 = CellZ(centre.z_ - radius);
+		int z1 = CellZ(centre.z_ + radius);
+
+		for (int z = z0; z <= z1; ++z)
+		{
+			const unsigned* row = &cellStart[z * width];
+			if (row[x0] < row[x1 + 1])
+				func(row[x0], row[x1 + 1]);
+		}
+	}
+
+	/// Entry indices in cell order, the order runs refer to.
+	const PODVector<unsigned>& GetEntries() const { return entries; }
+
+private:
+	int CellX(float x) const { return ToCell((x - minX) * invCellSize, width); }
+	int CellZ(float z) const { return ToCell((z - minZ) * invCellSize, height); }
+	// Clamp in float before the cast, which is undefined for NaN and out of range values. NaN goes to cell 0.
+	static int ToCell(float cell, int count) { return cell > 0.0f ? (cell < (float)(count - 1) ? (int)cell : count - 1) : 0; }
+
+	float cellSize;
+	float invCellSize;
+	float minX;
+	float minZ;
+	int width;
+	int height;
+
+	/// First entry of each cell, plus one past the end, in row-major order.
+	PODVector<unsigned> cellStart;
+	/// Entry indices sorted by cell.
+	PODVector<unsigned> entries;
+	/// Cell of each input position, M_MAX_UNSIGNED when left out.
+	PODVector<unsigned> entryCell;
+};
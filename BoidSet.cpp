@@ -1,24 +1,189 @@
 #include "BoidSet.h"
+#include "FlockRenderer.h"
+#include "Prefab.h"
 
 BoidSet::BoidSet()
 {
 	isActive = false;
-	for (int i = 0; i < num; i++) {
-		boidList[i] = Boid();
+	syncNodes = false;
+	pNode = nullptr;
+	pRenderer = nullptr;
+	isKinematic = false;
+}
+
+void BoidSet::Initialise(ResourceCache *pRes, Scene *pScene, unsigned capacity, unsigned count, bool kinematic, unsigned seed)
+{
+	isKinematic = kinematic;
+	random.SetSeed(seed);
+
+	pNode = pScene->CreateChild("Flock");
+	pRenderer = pNode->CreateComponent<FlockRenderer>();
+	pRenderer->SetModel(pRes->GetResource<Model>("Models/ptewing.mdl"));
+	pRenderer->SetMaterial(pRes->GetResource<Material>("Materials/Stone.xml"));
+
+	boidList.Resize(capacity);
+	indexOfSlot.Resize(capacity);
+	generation.Resize(capacity);
+	slotOfIndex.Reserve(capacity);
+	slotOfIndex.Clear();
+	freeList.Reserve(capacity);
+	freeList.Clear();
+	slotOfBody.Clear();
+	flock.Reserve(capacity);
+	flock.Resize(0);
+
+	// Every boid is the same, so set one up and clone it for the whole pool
+	Prefab prefab(pScene->GetContext(), "Boid");
+	Boid::SetupNode(prefab.GetTemplate(), kinematic);
+	PODVector<Node*> nodes;
+	// Clients get the flock from snapshots, so the boid nodes stay on the server
+	prefab.Instantiate(pNode, capacity, LOCAL, nodes);
+
+	// Hand out low slots first
+	for (unsigned i = capacity; i-- > 0;) {
+		boidList[i].Attach(nodes[i]);
+		if (boidList[i].pRigidBody)
+			slotOfBody[boidList[i].pRigidBody] = i;
+		indexOfSlot[i] = M_MAX_UNSIGNED;
+		generation[i] = 0;
+		freeList.Push(i);
+	}
+
+	SetNumBoids(count);
+}
+
+BoidHandle BoidSet::Spawn(const Vector3& position)
+{
+	BoidHandle handle;
+	handle.slot = M_MAX_UNSIGNED;
+	handle.generation = 0;
+	if (freeList.Empty())
+		return handle;
+
+	unsigned slot = freeList.Back();
+	freeList.Pop();
+	boidList[slot].Spawn(position);
+
+	unsigned index = flock.GetNumBoids();
+	flock.Resize(index + 1);
+	flock.position[index] = position;
+	flock.velocity[index] = Vector3::ZERO;
+	flock.force[index] = Vector3::ZERO;
+	flock.alive[index] = true;
+	slotOfIndex.Push(slot);
+	indexOfSlot[slot] = index;
+
+	handle.slot = slot;
+	handle.generation = generation[slot];
+	return handle;
+}
+
+void BoidSet::Despawn(const BoidHandle& handle)
+{
+	unsigned index = GetIndex(handle);
+	if (index != M_MAX_UNSIGNED)
+		Release(index);
+}
+
+unsigned BoidSet::GetIndex(const BoidHandle& handle) const
+{
+	if (handle.slot >= boidList.Size() || generation[handle.slot] != handle.generation)
+		return M_MAX_UNSIGNED;
+	return indexOfSlot[handle.slot];
+}
+
+BoidHandle BoidSet::GetHandle(unsigned index) const
+{
+	BoidHandle handle;
+	handle.slot = slotOfIndex[index];
+	handle.generation = generation[handle.slot];
+	return handle;
+}
+
+void BoidSet::Release(unsigned index)
+{
+	unsigned slot = slotOfIndex[index];
+	boidList[slot].Despawn();
+	indexOfSlot[slot] = M_MAX_UNSIGNED;
+	generation[slot]++;
+	freeList.Push(slot);
+
+	unsigned last = slotOfIndex.Size() - 1;
+	if (index != last) {
+		slotOfIndex[index] = slotOfIndex[last];
+		indexOfSlot[slotOfIndex[index]] = index;
 	}
+	slotOfIndex.Pop();
+	flock.RemoveSwap(index);
+}
+
+bool BoidSet::Kill(unsigned index)
+{
+	if (index >= flock.GetNumBoids() || !flock.alive[index])
+		return false;
+
+	flock.alive[index] = false;
+	boidList[slotOfIndex[index]].Kill();
+	return true;
+}
+
+unsigned BoidSet::FindIndex(RigidBody* body) const
+{
+	HashMap<RigidBody*, unsigned>::ConstIterator i = slotOfBody.Find(body);
+	return i != slotOfBody.End() ? indexOfSlot[i->second_] : M_MAX_UNSIGNED;
+}
+
+void BoidSet::SetNumBoids(unsigned count)
+{
+	count = Min(count, GetCapacity());
+
+	while (GetNumBoids() < count)
+		Spawn(Vector3(random.Next(180.0f) - 90.0f, 1.5f, random.Next(180.0f) - 90.0f));
+
+	while (GetNumBoids() > count)
+		Release(GetNumBoids() - 1);
 }
 
-void BoidSet::Initialise(ResourceCache *pRes, Scene *pScene)
+void BoidSet::Gather()
 {
-	for (int i = 0; i < num; i++) {
-		boidList[i].Initialise(pRes, pScene);
-	}											   
+	// Walking down, what moves into a released index has already been checked
+	for (unsigned i = flock.GetNumBoids(); i-- > 0;) {
+		if (!flock.alive[i])
+			Release(i);
+	}
+
+	if (isKinematic)
+		return;
+
+	// Copy body state into the flock arrays once, so the force phase never touches a component
+	for (unsigned i = 0; i < flock.GetNumBoids(); i++) {
+		Boid& boid = boidList[slotOfIndex[i]];
+		boid.ReadState(flock.position[i], flock.velocity[i]);
+		flock.alive[i] = !boid.isDead;
+	}
 }
 
 void BoidSet::Update(float tm)
 {
-	for (int i = 0; i < num; i++) {
-		boidList[i].ComputeForce(&boidList[0], num);
-		boidList[i].Update(tm);
+	unsigned num = flock.GetNumBoids();
+
+	if (isKinematic) {
+		flock.Integrate(tm);
+		pRenderer->SetInstances(flock);
+		if (syncNodes) {
+			for (unsigned i = 0; i < num; i++) {
+				if (flock.alive[i])
+					boidList[slotOfIndex[i]].Place(flock.position[i], flock.velocity[i]);
+			}
+		}
+		return;
+	}
+
+	// Drawn where the bodies were at the start of this step
+	pRenderer->SetInstances(flock);
+
+	for (unsigned i = 0; i < num; i++) {
+		if (flock.alive[i])
+			boidList[slotOfIndex[i]].Update(flock.force[i], flock.position[i], flock.velocity[i], tm);
 	}
 }
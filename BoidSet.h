@@ -1,15 +1,78 @@
 #pragma once
 #include "Boid.h"
+#include "Flock.h"
 
-class BoidSet
+class FlockRenderer;
+
+// Stable reference to a spawned boid. The generation changes every time its slot is reused,
+// so a handle kept past the boid's despawn is recognised as stale instead of naming another boid.
+struct BoidHandle
+{
+	unsigned slot;
+	unsigned generation;
+};
+
+// A flock of pooled boids. All nodes and flock arrays are created up front by Initialise,
+// after which spawning and despawning only moves slots on and off the free list.
+// The flock arrays only hold spawned boids, packed from 0. A despawned or shot boid is swap-removed,
+// so every loop over the flock costs the live boids only. Pool slots own the nodes and never move.
+// The boid nodes only carry physics, the whole flock is drawn by one FlockRenderer on their parent node.
+class BoidSet : public RefCounted
 {
 public:
-	const int num = 25;
-	Boid boidList[25];
+	Vector<Boid> boidList;
 	BoidSet();
-	void Initialise(ResourceCache *pRes, Scene *pScene);
+	// Kinematic flocks integrate themselves and have no rigid bodies, shots are found by sweeping bullets against a FlockWorld.
+	// Spawn positions come from seed alone, so a kinematic flock stepped at a fixed rate replays exactly.
+	void Initialise(ResourceCache *pRes, Scene *pScene, unsigned capacity, unsigned count, bool kinematic, unsigned seed);
+	// A step is Gather, then the force phase on flock (alone or in a FlockWorld), then Update.
+	// Gather also removes the boids shot since the last step, flock indices are stable until the next one.
+	void Gather();
+	// Apply flock.force to the boids, integrating kinematic ones
 	void Update(float tm);
+	bool IsKinematic() const { return isKinematic; }
+
+	// Take a slot from the pool and place a boid in it. The handle's slot is M_MAX_UNSIGNED when the pool is empty.
+	BoidHandle Spawn(const Vector3& position);
+	void Despawn(const BoidHandle& handle);
+	// Return the boid's index in the flock arrays, or M_MAX_UNSIGNED if the handle is stale
+	unsigned GetIndex(const BoidHandle& handle) const;
+	bool IsValid(const BoidHandle& handle) const { return GetIndex(handle) != M_MAX_UNSIGNED; }
+	// Handle of the boid at a flock index
+	BoidHandle GetHandle(unsigned index) const;
+	// Shoot the boid at a flock index. It stays in the flock, dead, until the next Gather returns it to the pool.
+	// Returns false if it was already dead.
+	bool Kill(unsigned index);
+	// Flock index of the boid owning a body, or M_MAX_UNSIGNED if it is not one of ours
+	unsigned FindIndex(RigidBody* body) const;
+	// Spawn or despawn boids at random positions until count are spawned
+	void SetNumBoids(unsigned count);
+	unsigned GetNumBoids() const { return flock.GetNumBoids(); }
+	unsigned GetCapacity() const { return boidList.Size(); }
 
 	bool isActive;
+	// Whether kinematic boids copy their state to their nodes, which nothing needs since snapshots replicate the flock
+	bool syncNodes;
+	Flock flock;
+	Node *pNode;
+	FlockRenderer *pRenderer;
+
+private:
+	// Return the boid at a flock index to the pool, moving the last boid into its place
+	void Release(unsigned index);
+
+	bool isKinematic;
+	// Spawn positions, kept apart from the global Random so nothing else shifts them
+	FlockRandom random;
+	// Unused slots, reserved to capacity so the pool never allocates
+	PODVector<unsigned> freeList;
+	// Pool slot of each flock index
+	PODVector<unsigned> slotOfIndex;
+	// Flock index of each pool slot, M_MAX_UNSIGNED while the slot is free
+	PODVector<unsigned> indexOfSlot;
+	// Bumped every time a slot is released
+	PODVector<unsigned> generation;
+	// Slot of each boid body, for collision events
+	HashMap<RigidBody*, unsigned> slotOfBody;
 }
-;
\ No newline at end of file
+;
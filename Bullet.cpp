@@ -1,8 +1,8 @@
 #include "Bullet.h"
+#include "CollisionTags.h"
 
-Bullet::Bullet(Quaternion rotation)
+Bullet::Bullet()
 {
-	direction = rotation.Normalized();
 	pNode = nullptr;
 	pRigidBody = nullptr;
 	pCollisionShape = nullptr;
@@ -15,20 +15,62 @@ Bullet::~Bullet()
 {
 }
 
-void Bullet::Initialize(ResourceCache* pRes, Scene* pScene, Vector3 position)
+void Bullet::Initialise(Node* pParent, Model* pModel, bool kinematic)
+{
+	Node* node = pParent->CreateChild("Bullet");
+	node->SetEnabled(false);
+	SetupNode(node, pModel, kinematic);
+	Attach(node);
+}
+
+void Bullet::SetupNode(Node* node, Model* pModel, bool kinematic)
 {
-	pNode = pScene->CreateChild("Bullet");
-	pRigidBody = pNode->CreateComponent<RigidBody>();
-	pCollisionShape = pNode->CreateComponent<CollisionShape>();
-	pCollisionShape->SetSphere(1.0f);
-	pObject = pNode->CreateComponent<StaticModel>();
+	StaticModel* object = node->CreateComponent<StaticModel>();
+	object->SetModel(pModel);
+	if (kinematic)
+		return;
 
-	pObject->SetModel(pRes->GetResource<Model>("Models/Sphere.mdl"));
+	RigidBody* body = node->CreateComponent<RigidBody>();
+	SetCollisionKind(body, COLLISION_BULLET);
+	CollisionShape* shape = node->CreateComponent<CollisionShape>();
+	shape->SetSphere(radius * 2.0f);
 
-	pRigidBody->SetMass(1.0f);
-	pRigidBody->SetUseGravity(false);
-	pRigidBody->SetPosition(position + (direction * Vector3::FORWARD * 5.0f));
+	body->SetMass(1.0f);
+	body->SetUseGravity(false);
+}
+
+void Bullet::Attach(Node* node)
+{
+	pNode = node;
+	pObject = node->GetComponent<StaticModel>();
+	pRigidBody = node->GetComponent<RigidBody>();
+	pCollisionShape = node->GetComponent<CollisionShape>();
+	Expire();
+}
+
+Vector3 Bullet::Fire(const Vector3& position, const Quaternion& rotation)
+{
+	direction = rotation.Normalized();
+	Vector3 muzzle = position + (direction * Vector3::FORWARD * 5.0f);
+	pNode->SetEnabled(true);
+	if (!pRigidBody) {
+		pNode->SetTransform(muzzle, direction);
+		return muzzle;
+	}
+	pRigidBody->SetPosition(muzzle);
 	pRigidBody->SetRotation(direction);
+	pRigidBody->SetLinearVelocity(direction * Vector3::FORWARD * moveSpeed);
+	return muzzle;
+}
+
+void Bullet::Place(const Vector3& position)
+{
+	pNode->SetPosition(position);
+}
+
+void Bullet::Expire()
+{
+	pNode->SetEnabled(false);
 }
 
 void Bullet::HandleCollisions(StringHash eventType, VariantMap& eventData)
@@ -43,8 +85,23 @@ void Bullet::Move()
 	}
 }
 
+void Bullet::SetContinuous(bool enable, float timeStep)
+{
+	if (!pRigidBody)
+		return;
+
+	// The shape is a sphere, so the swept sphere is the whole shape
+	if (enable && moveSpeed * timeStep > radius) {
+		pRigidBody->SetCcdRadius(radius);
+		pRigidBody->SetCcdMotionThreshold(radius);
+	}
+	else {
+		pRigidBody->SetCcdRadius(0.0f);
+		pRigidBody->SetCcdMotionThreshold(0.0f);
+	}
+}
+
 Node* Bullet::GetNode()
 {
 	return pNode;
 }
-
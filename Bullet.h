@@ -36,24 +36,45 @@ namespace Urho3D
 
 using namespace Urho3D;
 
+// Scene side of one pooled projectile. BulletSet creates the node and components once
+// and keeps the per shot state, firing only re-enables and places the node.
 class Bullet
 {
-
-	Quaternion direction;
-	const float moveSpeed = 40.0f;
 public:
+	static constexpr float moveSpeed = 40.0f;
+	static constexpr float radius = 0.5f;
+
 	Node* pNode;
 	RigidBody* pRigidBody;
 	CollisionShape* pCollisionShape;
 	StaticModel* pObject;
 
-	Bullet(Quaternion rotation);
+	Bullet();
 	~Bullet();
 
-	void Initialize(ResourceCache* pRes, Scene* pScene, Vector3 position);
+	// Create the node under the pool's node. Kinematic bullets get no physics components,
+	// their hits are found by sweeping them against the flocks. The bullet starts out disabled.
+	void Initialise(Node* pParent, Model* pModel, bool kinematic);
+	// Add a bullet's components to a node, usually a Prefab template that is then cloned for the whole pool
+	static void SetupNode(Node* pNode, Model* pModel, bool kinematic);
+	// Take over a node set up by SetupNode. The bullet starts out disabled.
+	void Attach(Node* pNode);
+	// Enable the bullet and send it off from position along rotation. Returns its muzzle position.
+	Vector3 Fire(const Vector3& position, const Quaternion& rotation);
+	// Set a kinematic bullet's node
+	void Place(const Vector3& position);
+	// Disable the node, which takes its body out of the physics world until it is fired again
+	void Expire();
 	void HandleCollisions(StringHash eventType, VariantMap& eventData);
 
+	// Hold a physics bullet at speed
 	void Move();
+	// Sweep a physics bullet's body between steps of timeStep when one step moves it further than its radius,
+	// so it cannot pass through a boid at a low physics rate. Off when enable is false or the step is short enough.
+	void SetContinuous(bool enable, float timeStep);
 
 	Node* GetNode();
-};
\ No newline at end of file
+
+private:
+	Quaternion direction;
+};
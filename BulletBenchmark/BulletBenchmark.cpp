@@ -0,0 +1,256 @@
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Graphics/Graphics.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/Math/Random.h>
+#include <Urho3D/Physics/PhysicsEvents.h>
+#include <Urho3D/Physics/PhysicsWorld.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "../Boid.h"
+#include "../Bullet.h"
+#include "../CollisionTags.h"
+
+// Distance between targets, far enough apart that a bullet only ever meets its own
+static const float TARGET_SPACING = 5.0f;
+// Distance from a bullet's muzzle to its target
+static const float TARGET_RANGE = 20.0f;
+// Largest sideways miss that still touches, bullet radius plus boid radius, less a margin
+static const float AIM_SPREAD = 0.6f;
+
+struct BenchmarkResult
+{
+	int fps;
+	bool ccd;
+	unsigned shots;
+	unsigned hits;
+	unsigned ticks;
+	double usPerTick;
+};
+
+// Marks the bullets that started touching a boid, the way the game's contact hits do
+class HitCounter : public Object
+{
+	URHO3D_OBJECT(HitCounter, Object);
+
+public:
+	HitCounter(Context* context) :
+		Object(context)
+	{
+		SubscribeToEvent(E_PHYSICSCOLLISIONSTART, URHO3D_HANDLER(HitCounter, HandleCollision));
+	}
+
+	HashMap<RigidBody*, unsigned> bulletOfBody;
+	PODVector<bool> hit;
+
+private:
+	void HandleCollision(StringHash eventType, VariantMap& eventData)
+	{
+		using namespace PhysicsCollisionStart;
+
+		RigidBody* bullet = static_cast<RigidBody*>(eventData[P_BODYA].GetPtr());
+		RigidBody* boid = static_cast<RigidBody*>(eventData[P_BODYB].GetPtr());
+		if (!bullet || !boid)
+			return;
+		if (GetCollisionKind(boid) == COLLISION_BULLET)
+			Swap(bullet, boid);
+		if (GetCollisionKind(bullet) != COLLISION_BULLET || GetCollisionKind(boid) != COLLISION_BOID)
+			return;
+
+		HashMap<RigidBody*, unsigned>::ConstIterator i = bulletOfBody.Find(bullet);
+		if (i != bulletOfBody.End())
+			hit[i->second_] = true;
+	}
+};
+
+static void PrintUsage()
+{
+	printf(
+		"Usage: BulletBenchmark [options]\n"
+		"  -fps <n>         Physics rate to run, may be repeated. Default 120, 60, 30, 20, 15, 10\n"
+		"  -bullets <n>     Bullets per volley, each at its own boid. Default 100\n"
+		"  -volleys <n>     Volleys per rate. Default 10\n"
+		"  -seed <n>        Random seed for aim and firing phase. Default 1\n"
+		"  -output <file>   Write the JSON report to a file instead of stdout\n");
+}
+
+static BenchmarkResult RunVolleys(PhysicsWorld* physicsWorld, Vector<Bullet>& bullets, Vector<Boid>& boids, HitCounter& counter,
+	int fps, bool ccd, unsigned volleys)
+{
+	float timeStep = 1.0f / fps;
+	physicsWorld->SetFps(fps);
+	for (unsigned i = 0; i < bullets.Size(); i++)
+		bullets[i].SetContinuous(ccd, timeStep);
+
+	// Long enough for every bullet to reach and pass its target
+	float stepLength = Bullet::moveSpeed * timeStep;
+	unsigned ticksPerVolley = (unsigned)Ceil((TARGET_RANGE + TARGET_SPACING) / stepLength);
+
+	BenchmarkResult result;
+	result.fps = fps;
+	result.ccd = ccd;
+	result.shots = 0;
+	result.hits = 0;
+	result.ticks = 0;
+
+	long long elapsed = 0;
+	HiresTimer timer;
+	for (unsigned v = 0; v < volleys; v++)
+	{
+		for (unsigned i = 0; i < boids.Size(); i++)
+		{
+			Vector3 target(i * TARGET_SPACING, 1.5f, 0.0f);
+			boids[i].Spawn(target);
+			// Random phase, so where the steps fall along the flight varies between volleys
+			Vector3 muzzle = target + Vector3(Random(-AIM_SPREAD, AIM_SPREAD), 0.0f, -TARGET_RANGE - Random(stepLength));
+			bullets[i].Fire(muzzle - Vector3::FORWARD * 5.0f, Quaternion::IDENTITY);
+			counter.hit[i] = false;
+		}
+
+		for (unsigned t = 0; t < ticksPerVolley; t++)
+		{
+			for (unsigned i = 0; i < bullets.Size(); i++)
+				bullets[i].Move();
+			timer.Reset();
+			physicsWorld->Update(timeStep);
+			elapsed += timer.GetUSec(false);
+		}
+
+		for (unsigned i = 0; i < bullets.Size(); i++)
+		{
+			if (counter.hit[i])
+				result.hits++;
+			bullets[i].Expire();
+			boids[i].Despawn();
+		}
+		result.shots += bullets.Size();
+		result.ticks += ticksPerVolley;
+	}
+
+	result.usPerTick = (double)elapsed / result.ticks;
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	const Vector<String>& arguments = ParseArguments(argc, argv);
+
+	PODVector<int> rates;
+	unsigned numBullets = 100;
+	unsigned volleys = 10;
+	unsigned seed = 1;
+	String outputName;
+
+	for (unsigned i = 0; i < arguments.Size(); i++)
+	{
+		String argument = arguments[i].ToLower();
+		String value = i + 1 < arguments.Size() ? arguments[i + 1] : String::EMPTY;
+
+		if (argument == "-fps" && !value.Empty())
+		{
+			rates.Push(Max(ToInt(value), 1));
+			++i;
+		}
+		else if (argument == "-bullets" && !value.Empty())
+		{
+			numBullets = Max(ToUInt(value), 1U);
+			++i;
+		}
+		else if (argument == "-volleys" && !value.Empty())
+		{
+			volleys = Max(ToUInt(value), 1U);
+			++i;
+		}
+		else if (argument == "-seed" && !value.Empty())
+		{
+			seed = ToUInt(value);
+			++i;
+		}
+		else if (argument == "-output" && !value.Empty())
+		{
+			outputName = value;
+			++i;
+		}
+		else
+		{
+			PrintUsage();
+			return argument == "-h" || argument == "-help" ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (rates.Empty())
+	{
+		rates.Push(120);
+		rates.Push(60);
+		rates.Push(30);
+		rates.Push(20);
+		rates.Push(15);
+		rates.Push(10);
+	}
+
+	SharedPtr<Context> context(new Context());
+	// Time sets up the high resolution timer frequency
+	context->RegisterSubsystem(new Time(context));
+	// Component factories only, nothing is drawn
+	RegisterGraphicsLibrary(context);
+	RegisterPhysicsLibrary(context);
+
+	SetRandomSeed(seed);
+
+	SharedPtr<Scene> scene(new Scene(context));
+	PhysicsWorld* physicsWorld = scene->CreateComponent<PhysicsWorld>();
+	// Only the steps the benchmark runs itself
+	physicsWorld->SetInterpolation(false);
+	Node* bulletNode = scene->CreateChild("Bullets");
+	Node* boidNode = scene->CreateChild("Boids");
+
+	HitCounter counter(context);
+	Vector<Bullet> bullets;
+	Vector<Boid> boids;
+	bullets.Resize(numBullets);
+	boids.Resize(numBullets);
+	counter.hit.Resize(numBullets);
+	for (unsigned i = 0; i < numBullets; i++)
+	{
+		bullets[i].Initialise(bulletNode, nullptr, false);
+		boids[i].Initialise(boidNode, false);
+		counter.bulletOfBody[bullets[i].pRigidBody] = i;
+	}
+
+	PODVector<BenchmarkResult> results;
+	for (unsigned i = 0; i < rates.Size(); i++)
+	{
+		results.Push(RunVolleys(physicsWorld, bullets, boids, counter, rates[i], false, volleys));
+		results.Push(RunVolleys(physicsWorld, bullets, boids, counter, rates[i], true, volleys));
+	}
+
+	String report;
+	report.AppendWithFormat("{\n  \"bullets\": %u,\n  \"volleys\": %u,\n  \"seed\": %u,\n  \"results\": [\n", numBullets, volleys, seed);
+	for (unsigned i = 0; i < results.Size(); i++)
+	{
+		const BenchmarkResult& r = results[i];
+		report.AppendWithFormat("    { \"fps\": %d, \"ccd\": %s, \"shots\": %u, \"hits\": %u, \"hitRate\": %.3f, \"usPerTick\": %.3f, \"usPerSecond\": %.3f }%s\n",
+			r.fps, r.ccd ? "true" : "false", r.shots, r.hits, (double)r.hits / r.shots, r.usPerTick, r.usPerTick * r.fps,
+			i + 1 < results.Size() ? "," : "");
+	}
+	report += "  ]\n}\n";
+
+	if (outputName.Empty())
+		PrintUnicode(report);
+	else
+	{
+		File file(context, outputName, FILE_WRITE);
+		if (!file.IsOpen())
+		{
+			fprintf(stderr, "Could not open %s for writing\n", outputName.CString());
+			return EXIT_FAILURE;
+		}
+		file.Write(report.CString(), report.Length());
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,159 @@
+#include "BulletSet.h"
+#include "Prefab.h"
+
+BulletSet::BulletSet()
+{
+	lifetime = 2.0f;
+	range = 60.0f;
+	pNode = nullptr;
+	isKinematic = true;
+	next = 0;
+	numLive = 0;
+}
+
+void BulletSet::Initialise(ResourceCache *pRes, Scene *pScene, unsigned capacity, bool kinematic)
+{
+	capacity = Max(capacity, 1U);
+	isKinematic = kinematic;
+	Model* model = pRes->GetResource<Model>("Models/Sphere.mdl");
+
+	pNode = pScene->CreateChild("Bullets");
+	bulletList.Resize(capacity);
+	live.Resize(capacity);
+	age.Resize(capacity);
+	origin.Resize(capacity);
+	position.Resize(capacity);
+	previous.Resize(capacity);
+	velocity.Resize(capacity);
+	owner.Resize(capacity);
+	lag.Resize(capacity);
+	slotOfBody.Clear();
+	liveOfOwner.Clear();
+
+	Prefab prefab(pScene->GetContext(), "Bullet");
+	Bullet::SetupNode(prefab.GetTemplate(), model, kinematic);
+	PODVector<Node*> nodes;
+	prefab.Instantiate(pNode, capacity, REPLICATED, nodes);
+
+	for (unsigned i = 0; i < capacity; i++) {
+		bulletList[i].Attach(nodes[i]);
+		live[i] = false;
+		age[i] = 0.0f;
+		owner[i] = 0;
+		lag[i] = 0.0f;
+		if (!kinematic)
+			slotOfBody[bulletList[i].pRigidBody] = i;
+	}
+	next = 0;
+	numLive = 0;
+}
+
+unsigned BulletSet::Fire(const Vector3& muzzle, const Quaternion& rotation, unsigned shooter, float shooterLag)
+{
+	unsigned slot = next;
+	next = (next + 1) % bulletList.Size();
+
+	// The ring is full, so the oldest bullet makes way
+	if (live[slot])
+		Expire(slot);
+
+	Vector3 start = bulletList[slot].Fire(muzzle, rotation);
+	live[slot] = true;
+	age[slot] = 0.0f;
+	origin[slot] = start;
+	position[slot] = start;
+	previous[slot] = start;
+	velocity[slot] = rotation.Normalized() * Vector3::FORWARD * Bullet::moveSpeed;
+	owner[slot] = shooter;
+	lag[slot] = shooterLag;
+	numLive++;
+	liveOfOwner[shooter]++;
+	return slot;
+}
+
+void BulletSet::Expire(unsigned slot)
+{
+	if (!IsLive(slot))
+		return;
+
+	bulletList[slot].Expire();
+	live[slot] = false;
+	numLive--;
+	liveOfOwner[owner[slot]]--;
+}
+
+unsigned BulletSet::GetNumLive(unsigned shooter) const
+{
+	HashMap<unsigned, unsigned>::ConstIterator i = liveOfOwner.Find(shooter);
+	return i != liveOfOwner.End() ? i->second_ : 0;
+}
+
+void BulletSet::SetContinuous(bool enable, float timeStep)
+{
+	for (unsigned i = 0; i < bulletList.Size(); i++)
+		bulletList[i].SetContinuous(enable, timeStep);
+}
+
+void BulletSet::SetInterest(NodeInterestSender& interest)
+{
+	for (unsigned i = 0; i < bulletList.Size(); i++)
+		interest.AddNode(bulletList[i].pNode);
+}
+
+void BulletSet::Update(float tm)
+{
+	if (!numLive)
+		return;
+
+	// Expiring before the move lets the last segment of a bullet's flight still be swept
+	float range2 = range * range;
+	for (unsigned i = 0; i < bulletList.Size(); i++) {
+		if (!live[i])
+			continue;
+
+		if (age[i] > lifetime || (position[i] - origin[i]).LengthSquared() > range2) {
+			Expire(i);
+			continue;
+		}
+
+		age[i] += tm;
+		previous[i] = position[i];
+		if (isKinematic) {
+			position[i] += velocity[i] * tm;
+			bulletList[i].Place(position[i]);
+		}
+		else {
+			// Bodies are stepped by physics after this, so the segment trails the body by a step
+			bulletList[i].Move();
+			position[i] = bulletList[i].pRigidBody->GetPosition();
+		}
+	}
+}
+
+void BulletSet::QueryHits(const FlockWorld& world, const FlockHistory& history, float now, float radius, float tm, HitQueue& queue) const
+{
+	if (!numLive)
+		return;
+
+	FlockHit target;
+	for (unsigned i = 0; i < bulletList.Size(); i++) {
+		if (!live[i])
+			continue;
+		bool touched = lag[i] > 0.0f ? history.SweepSphere(now - lag[i], previous[i], position[i], radius, tm, target) :
+			world.SweepSphere(previous[i], position[i], radius, tm, target);
+		if (!touched)
+			continue;
+		BoidHit hit;
+		hit.bullet = i;
+		hit.owner = owner[i];
+		hit.flock = target.flock;
+		hit.boid = target.boid;
+		queue.Push(hit);
+	}
+}
+
+unsigned BulletSet::FindSlot(RigidBody* body) const
+{
+	HashMap<RigidBody*, unsigned>::ConstIterator i = slotOfBody.Find(body);
+	return i != slotOfBody.End() ? i->second_ : M_MAX_UNSIGNED;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "Bullet.h"
+#include "FlockHistory.h"
+#include "FlockWorld.h"
+#include "HitQueue.h"
+#include "Interest.h"
+
+// A fixed size ring of pooled bullets. Initialise creates every node and component up front,
+// firing takes the next slot of the ring and recycles it if it is still in flight,
+// which is always the oldest bullet. Per shot state is kept in flat arrays indexed by slot.
+// Kinematic bullets move themselves and never generate physics contacts, every bullet's hits on boids
+// come from sweeping the segment it moved along this step against the flocks.
+class BulletSet : public RefCounted
+{
+public:
+	Vector<Bullet> bulletList;
+	BulletSet();
+	void Initialise(ResourceCache *pRes, Scene *pScene, unsigned capacity, bool kinematic);
+	// Fire a bullet for owner, usually the firing node's ID. Returns the slot it took.
+	// A bullet with lag is tested against the boids as they were lag seconds before each step, which is what its shooter saw.
+	unsigned Fire(const Vector3& position, const Quaternion& rotation, unsigned owner, float lag = 0.0f);
+	void Expire(unsigned slot);
+	// Turn continuous collision on or off for physics bullets, for a physics world stepping at timeStep
+	void SetContinuous(bool enable, float timeStep);
+	// Only send bullets to the clients within range of them
+	void SetInterest(NodeInterestSender& interest);
+	// Expire bullets past their lifetime or range, then move the rest on by tm and age them
+	void Update(float tm);
+	// Sweep every live bullet's last move against the flocks, with boids swept over the same tm,
+	// and queue what they hit. Bullets with lag are swept against history rewound from time now.
+	// Nothing is changed until the queue is applied.
+	void QueryHits(const FlockWorld& world, const FlockHistory& history, float now, float radius, float tm, HitQueue& queue) const;
+	// Slot of a pooled bullet's body, or M_MAX_UNSIGNED if it is not one of ours
+	unsigned FindSlot(RigidBody* body) const;
+
+	unsigned GetNumLive() const { return numLive; }
+	// Bullets in flight fired by owner
+	unsigned GetNumLive(unsigned owner) const;
+	unsigned GetCapacity() const { return bulletList.Size(); }
+	bool IsKinematic() const { return isKinematic; }
+	bool IsLive(unsigned slot) const { return slot < live.Size() && live[slot]; }
+	unsigned GetOwner(unsigned slot) const { return owner[slot]; }
+	const Vector3& GetPosition(unsigned slot) const { return position[slot]; }
+
+	// Seconds a bullet flies before it is expired
+	float lifetime;
+	// Distance from its muzzle a bullet may travel before it is expired
+	float range;
+	Node *pNode;
+
+private:
+	bool isKinematic;
+	// Next slot to fire from
+	unsigned next;
+	unsigned numLive;
+	PODVector<bool> live;
+	PODVector<float> age;
+	PODVector<Vector3> origin;
+	// Position after the last Update and before it, the segment QueryHits sweeps
+	PODVector<Vector3> position;
+	PODVector<Vector3> previous;
+	PODVector<Vector3> velocity;
+	PODVector<unsigned> owner;
+	PODVector<float> lag;
+	// Live bullets of each owner, so budgets are checked without walking the ring
+	HashMap<unsigned, unsigned> liveOfOwner;
+	// Slot of each pooled body, for collision events
+	HashMap<RigidBody*, unsigned> slotOfBody;
+}
+;
@@ -0,0 +1,46 @@
+#pragma once
+#include <Urho3D/Physics/RigidBody.h>
+
+using namespace Urho3D;
+
+/// What a body is, stored as its collision layer. Each kind has one bit, so a contact
+/// is classified from the layer alone.
+enum CollisionKind
+{
+	COLLISION_PLAYER = 1,
+	/// Static scenery, which the camera raycasts against.
+	COLLISION_WORLD = 2,
+	COLLISION_BOID = 4,
+	COLLISION_BULLET = 8
+};
+
+/// Kinds each kind collides with. These decide which contacts raise events, so pairs the game has no use for
+/// are left out. Bullets only hit boids and scenery, never players or each other. Boids keep apart by
+/// steering, so they pass through each other rather than raising a contact per neighbouring pair.
+static const unsigned COLLISION_MASK_PLAYER = COLLISION_PLAYER | COLLISION_WORLD | COLLISION_BOID;
+static const unsigned COLLISION_MASK_WORLD = COLLISION_PLAYER | COLLISION_BOID | COLLISION_BULLET;
+static const unsigned COLLISION_MASK_BOID = COLLISION_PLAYER | COLLISION_WORLD | COLLISION_BULLET;
+static const unsigned COLLISION_MASK_BULLET = COLLISION_WORLD | COLLISION_BOID;
+
+/// Tag a body as kind, with that kind's collision mask. Physics drops a pair's events if either body is
+/// COLLISION_NEVER, so every kind reports. Bullets always do, so a hit on a resting boid still counts.
+/// Bodies that need other events, like the character's ground test, set their mode afterwards.
+inline void SetCollisionKind(RigidBody* body, CollisionKind kind)
+{
+	unsigned mask = 0;
+	switch (kind)
+	{
+	case COLLISION_PLAYER: mask = COLLISION_MASK_PLAYER; break;
+	case COLLISION_WORLD: mask = COLLISION_MASK_WORLD; break;
+	case COLLISION_BOID: mask = COLLISION_MASK_BOID; break;
+	case COLLISION_BULLET: mask = COLLISION_MASK_BULLET; break;
+	}
+	body->SetCollisionLayerAndMask((unsigned)kind, mask);
+	body->SetCollisionEventMode(kind == COLLISION_BULLET ? COLLISION_ALWAYS : COLLISION_ACTIVE);
+}
+
+/// Kind a body was tagged with.
+inline CollisionKind GetCollisionKind(const RigidBody* body)
+{
+	return (CollisionKind)body->GetCollisionLayer();
+}
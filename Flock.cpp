@@ -0,0 +1,348 @@
+#include <Urho3D/Core/WorkQueue.h>
+
+#include "Flock.h"
+
+#ifdef URHO3D_SSE
+#include <emmintrin.h>
+#endif
+
+// Boids per work item in the force phase
+static const unsigned FORCE_CHUNK_SIZE = 256;
+// Kinematic limits, the same ones Boid::Update applies to rigid bodies
+static const float MIN_SPEED = 10.0f;
+static const float MAX_SPEED = 50.0f;
+static const float FLOCK_HEIGHT = 1.5f;
+
+// Neighbour rules of the classic flock, which the SSE kernel hard codes
+typedef Cohesion<ClassicFlockTuning> ClassicCohesion;
+typedef Separation<ClassicFlockTuning> ClassicSeparation;
+typedef FusedAlignment<ClassicFlockTuning> ClassicAlignment;
+
+Flock::Flock()
+{
+	useGrid = true;
+	species = 0;
+	neighbourMask = M_MAX_UNSIGNED;
+	kernel = IsKernelSupported(FLOCK_KERNEL_SSE) ? FLOCK_KERNEL_SSE : FLOCK_KERNEL_SCALAR;
+	index = &ownIndex;
+	indexBase = 0;
+	uniformWeights = true;
+	gridDrift = 0.0f;
+	flockCount = 0;
+	SetInteractions(nullptr);
+	SetRules<ClassicFlockRules>();
+}
+
+bool Flock::IsKernelSupported(FlockKernel requested)
+{
+#ifdef URHO3D_SSE
+	return requested == FLOCK_KERNEL_SCALAR || requested == FLOCK_KERNEL_SSE;
+#else
+	return requested == FLOCK_KERNEL_SCALAR;
+#endif
+}
+
+void Flock::Resize(unsigned count)
+{
+	position.Resize(count);
+	velocity.Resize(count);
+	force.Resize(count);
+	alive.Resize(count);
+	visited.Resize(count);
+}
+
+void Flock::Reserve(unsigned count)
+{
+	position.Reserve(count);
+	velocity.Reserve(count);
+	force.Reserve(count);
+	alive.Reserve(count);
+	visited.Reserve(count);
+}
+
+void Flock::RemoveSwap(unsigned boid)
+{
+	if (boid >= position.Size())
+		return;
+
+	unsigned last = position.Size() - 1;
+	position[boid] = position[last];
+	velocity[boid] = velocity[last];
+	force[boid] = force[last];
+	alive[boid] = alive[last];
+	visited[boid] = visited[last];
+	Resize(last);
+}
+
+unsigned long long Flock::GetNumNeighboursVisited() const
+{
+	unsigned long long total = 0;
+	for (unsigned i = 0; i < visited.Size(); i++)
+		total += visited[i];
+	return total;
+}
+
+void Flock::ComputeForces(WorkQueue* queue)
+{
+	Flock* self = this;
+
+	UpdateTotals();
+	SetInteractions(nullptr);
+	ownIndex.Build(&self, 1, useGrid);
+	index = &ownIndex;
+
+	if (QueueForces(queue))
+		queue->Complete(M_MAX_UNSIGNED);
+}
+
+void Flock::UpdateTotals()
+{
+	flockSum = Vector3::ZERO;
+	flockCount = 0;
+	for (unsigned i = 0; i < position.Size(); i++)
+	{
+		if (alive[i])
+		{
+			flockSum += position[i];
+			flockCount++;
+		}
+	}
+}
+
+void Flock::SetInteractions(const FlockInteraction* row)
+{
+	for (unsigned s = 0; s < MAX_FLOCK_SPECIES; s++)
+	{
+		if (!(neighbourMask & (1u << s)))
+			interactions[s].schooling = interactions[s].avoidance = 0.0f;
+		else if (row)
+			interactions[s] = row[s];
+		else
+			interactions[s].schooling = interactions[s].avoidance = 1.0f;
+	}
+}
+
+bool Flock::QueueForces(WorkQueue* queue)
+{
+	unsigned num = position.Size();
+
+	uniformWeights = false;
+	if (index->IsSingleSpecies() && index->GetNumEntries())
+	{
+		const FlockInteraction& weight = interactions[index->species[0]];
+		uniformWeights = weight.schooling == 1.0f && weight.avoidance == 1.0f;
+	}
+
+	if (!queue || queue->GetNumThreads() == 0 || num <= FORCE_CHUNK_SIZE)
+	{
+		(this->*forceRange)(0, num);
+		return false;
+	}
+
+	for (unsigned begin = 0; begin < num; begin += FORCE_CHUNK_SIZE)
+	{
+		unsigned end = Min(begin + FORCE_CHUNK_SIZE, num);
+		SharedPtr<WorkItem> item = queue->GetFreeItem();
+		item->priority_ = M_MAX_UNSIGNED;
+		item->workFunction_ = ComputeForcesWork;
+		item->aux_ = this;
+		item->start_ = &force[0] + begin;
+		item->end_ = &force[0] + end;
+		queue->AddWorkItem(item);
+	}
+	return true;
+}
+
+void Flock::Integrate(float timeStep)
+{
+	float fastest = 0.0f;
+	for (unsigned i = 0; i < position.Size(); i++)
+	{
+		if (!alive[i])
+			continue;
+
+		Vector3 vel = velocity[i] + force[i] * timeStep;
+		float d = vel.Length();
+		if (d < MIN_SPEED)
+		{
+			d = MIN_SPEED;
+			vel = vel.Normalized() * d;
+		}
+		else if (d > MAX_SPEED)
+		{
+			d = MAX_SPEED;
+			vel = vel.Normalized() * d;
+		}
+		fastest = Max(fastest, d);
+
+		velocity[i] = vel;
+		position[i] += vel * timeStep;
+		position[i].y_ = FLOCK_HEIGHT;
+	}
+	gridDrift += fastest * timeStep;
+}
+
+unsigned Flock::FindNearest(const Vector3& centre, float radius) const
+{
+	unsigned nearest = M_MAX_UNSIGNED;
+	float best = radius * radius;
+	unsigned num = position.Size();
+
+	// A shared index holds other flocks' boids too, their ids fall outside this flock's range
+	index->ForEachCandidate(centre, radius + gridDrift, [&](unsigned id) {
+		unsigned i = id - indexBase;
+		if (id < indexBase || i >= num || !alive[i])
+			return;
+		float d2 = (position[i] - centre).LengthSquared();
+		if (d2 <= best)
+		{
+			best = d2;
+			nearest = i;
+		}
+	});
+	return nearest;
+}
+
+unsigned Flock::GetStateHash(unsigned hash) const
+{
+	for (unsigned i = 0; i < position.Size(); ++i)
+	{
+		if (!alive[i])
+			continue;
+		const unsigned char* bytes[] = { (const unsigned char*)position[i].Data(), (const unsigned char*)velocity[i].Data() };
+		for (unsigned v = 0; v < 2; ++v)
+		{
+			for (unsigned b = 0; b < sizeof(Vector3); ++b)
+				hash = (hash ^ bytes[v][b]) * 16777619u;
+		}
+	}
+	return hash;
+}
+
+Quaternion Flock::GetHeading(const Vector3& velocity)
+{
+	Vector3 vn = velocity.Normalized();
+	Vector3 cp = -vn.CrossProduct(Vector3(0.0f, 1.0f, 0.0f));
+	if (cp.LengthSquared() < M_EPSILON)
+		return Quaternion::IDENTITY;
+	float dp = cp.DotProduct(vn);
+	return Quaternion(Acos(dp), cp);
+}
+
+void Flock::ComputeForcesWork(const WorkItem* item, unsigned /*threadIndex*/)
+{
+	Flock* flock = reinterpret_cast<Flock*>(item->aux_);
+	Vector3* first = &flock->force[0];
+	unsigned begin = (unsigned)(reinterpret_cast<Vector3*>(item->start_) - first);
+	unsigned end = (unsigned)(reinterpret_cast<Vector3*>(item->end_) - first);
+	(flock->*flock->forceRange)(begin, end);
+}
+
+#ifdef URHO3D_SSE
+static inline float HorizontalSum(__m128 v)
+{
+	__m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	return _mm_cvtss_f32(sums);
+}
+#endif
+
+template <> void Flock::AccumulateRun<ClassicFlockRules>(unsigned self, unsigned begin, unsigned end, ClassicFlockRules::Sums& sums) const
+{
+	if (kernel == FLOCK_KERNEL_SSE && uniformWeights)
+		AccumulateSSE<false>(self, begin, end, sums);
+	else if (kernel == FLOCK_KERNEL_SSE)
+		AccumulateSSE<true>(self, begin, end, sums);
+	else
+		AccumulateScalar<ClassicFlockRules>(self, begin, end, sums);
+}
+
+template <bool Weighted> void Flock::AccumulateSSE(unsigned self, unsigned begin, unsigned end, ClassicFlockRules::Sums& sums) const
+{
+#ifdef URHO3D_SSE
+	const FlockIndex& idx = *index;
+	const Vector3& pos = position[self];
+	const __m128 selfX = _mm_set1_ps(pos.x_);
+	const __m128 selfY = _mm_set1_ps(pos.y_);
+	const __m128 selfZ = _mm_set1_ps(pos.z_);
+	const __m128i selfId = _mm_set1_epi32((int)(indexBase + self));
+	const __m128 rA2 = _mm_set1_ps(ClassicCohesion::Range * ClassicCohesion::Range);
+	const __m128 rR2 = _mm_set1_ps(ClassicSeparation::Range * ClassicSeparation::Range);
+	const __m128 rL2 = _mm_set1_ps(ClassicAlignment::Range * ClassicAlignment::Range);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 three = _mm_set1_ps(3.0f);
+	const __m128i lane = _mm_set_epi32(3, 2, 1, 0);
+	const __m128i last = _mm_set1_epi32((int)end);
+
+	__m128 comX = zero, comY = zero, comZ = zero, count = zero;
+	__m128 diffX = zero, diffY = zero, diffZ = zero;
+	__m128 dirX = zero, dirY = zero, dirZ = zero, countL = zero;
+
+	for (unsigned j = begin; j < end; j += 4)
+	{
+		__m128 px = _mm_loadu_ps(&idx.x[j]);
+		__m128 py = _mm_loadu_ps(&idx.y[j]);
+		__m128 pz = _mm_loadu_ps(&idx.z[j]);
+		__m128i id = _mm_loadu_si128((const __m128i*)&idx.id[j]);
+
+		// Lanes past the end of the run, and this boid itself, take no part
+		__m128i inRun = _mm_cmplt_epi32(_mm_add_epi32(_mm_set1_epi32((int)j), lane), last);
+		__m128 valid = _mm_castsi128_ps(_mm_andnot_si128(_mm_cmpeq_epi32(id, selfId), inRun));
+
+		__m128 sx = _mm_sub_ps(selfX, px);
+		__m128 sy = _mm_sub_ps(selfY, py);
+		__m128 sz = _mm_sub_ps(selfZ, pz);
+		__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, sx), _mm_mul_ps(sy, sy)), _mm_mul_ps(sz, sz));
+
+		__m128 inA = _mm_and_ps(valid, _mm_cmplt_ps(d2, rA2));
+		__m128 inR = _mm_and_ps(valid, _mm_and_ps(_mm_cmplt_ps(d2, rR2), _mm_cmpgt_ps(d2, zero)));
+		__m128 inL = _mm_and_ps(valid, _mm_cmplt_ps(d2, rL2));
+
+		// Estimate plus one Newton-Raphson step. Zero and padding lanes go NaN here but are masked off.
+		__m128 r = _mm_rsqrt_ps(d2);
+		r = _mm_mul_ps(_mm_mul_ps(half, r), _mm_sub_ps(three, _mm_mul_ps(_mm_mul_ps(d2, r), r)));
+
+		__m128 school = one;
+		if (Weighted)
+		{
+			// No gather in SSE2, the species table is small enough to look up lane by lane
+			const int* sp = &idx.species[j];
+			school = _mm_setr_ps(interactions[sp[0]].schooling, interactions[sp[1]].schooling,
+				interactions[sp[2]].schooling, interactions[sp[3]].schooling);
+			r = _mm_mul_ps(r, _mm_setr_ps(interactions[sp[0]].avoidance, interactions[sp[1]].avoidance,
+				interactions[sp[2]].avoidance, interactions[sp[3]].avoidance));
+		}
+
+		__m128 schoolA = _mm_and_ps(inA, school);
+		comX = _mm_add_ps(comX, _mm_mul_ps(schoolA, px));
+		comY = _mm_add_ps(comY, _mm_mul_ps(schoolA, py));
+		comZ = _mm_add_ps(comZ, _mm_mul_ps(schoolA, pz));
+		count = _mm_add_ps(count, schoolA);
+
+		diffX = _mm_add_ps(diffX, _mm_and_ps(inR, _mm_mul_ps(sx, r)));
+		diffY = _mm_add_ps(diffY, _mm_and_ps(inR, _mm_mul_ps(sy, r)));
+		diffZ = _mm_add_ps(diffZ, _mm_and_ps(inR, _mm_mul_ps(sz, r)));
+
+		__m128 schoolL = _mm_and_ps(inL, school);
+		dirX = _mm_add_ps(dirX, _mm_mul_ps(schoolL, _mm_loadu_ps(&idx.vx[j])));
+		dirY = _mm_add_ps(dirY, _mm_mul_ps(schoolL, _mm_loadu_ps(&idx.vy[j])));
+		dirZ = _mm_add_ps(dirZ, _mm_mul_ps(schoolL, _mm_loadu_ps(&idx.vz[j])));
+		countL = _mm_add_ps(countL, schoolL);
+	}
+
+	ClassicCohesion::Sums& cohesion = sums;
+	ClassicSeparation::Sums& separation = sums;
+	ClassicAlignment::Sums& alignment = sums;
+	cohesion.centre += Vector3(HorizontalSum(comX), HorizontalSum(comY), HorizontalSum(comZ));
+	cohesion.cohesionCount += HorizontalSum(count);
+	separation.away += Vector3(HorizontalSum(diffX), HorizontalSum(diffY), HorizontalSum(diffZ));
+	alignment.heading += Vector3(HorizontalSum(dirX), HorizontalSum(dirY), HorizontalSum(dirZ));
+	alignment.alignmentCount += HorizontalSum(countL);
+#else
+	AccumulateScalar<ClassicFlockRules>(self, begin, end, sums);
+#endif
+}
@@ -0,0 +1,207 @@
+#pragma once
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Quaternion.h>
+#include <Urho3D/Math/Vector3.h>
+
+#include "FlockIndex.h"
+#include "FlockRules.h"
+
+namespace Urho3D
+{
+	class WorkQueue;
+	struct WorkItem;
+}
+
+using namespace Urho3D;
+
+/// Neighbour loop implementation used by Flock::ComputeForces.
+enum FlockKernel
+{
+	FLOCK_KERNEL_SCALAR = 0,
+	FLOCK_KERNEL_SSE
+};
+
+/// Starting value of Flock::GetStateHash, FNV-1a's offset basis.
+static const unsigned FLOCK_HASH_BASIS = 2166136261u;
+
+/// Seeded random numbers for spawning boids. Same generator as Urho's Rand(), but with its own state,
+/// so a flock's layout only depends on its seed.
+class FlockRandom
+{
+public:
+	FlockRandom(unsigned initialSeed = 1) : seed(initialSeed) {}
+
+	void SetSeed(unsigned value) { seed = value; }
+	/// Return a float from 0 to range.
+	float Next(float range)
+	{
+		seed = seed * 214013 + 2531011;
+		return ((seed >> 16) & 32767) * range / 32768.0f;
+	}
+
+private:
+	unsigned seed;
+};
+
+/// Flock simulation state, kept as parallel arrays indexed by boid.
+/// Scene nodes and rigid bodies are only a view of this: BoidSet copies their state in once per step
+/// and writes the resulting forces back out, so the neighbour loops never touch a component.
+/// The steering rules are a compile-time rule set (see FlockRules.h), chosen per flock with SetRules().
+/// A step runs in two phases. ComputeForces packs a read-only copy of the live boids and fills force[] from it,
+/// and only after that does the caller integrate, so every force comes from the same state.
+class Flock
+{
+public:
+	Flock();
+
+	/// Steer with the given rule set. Defaults to ClassicFlockRules.
+	template <class Rules> void SetRules()
+	{
+		forceRange = &Flock::ComputeForceRangeWith<Rules>;
+		neighbourRange = Rules::Range;
+	}
+
+	void Resize(unsigned count);
+	/// Reserve room for count boids, so growing up to it never allocates.
+	void Reserve(unsigned count);
+	/// Remove a boid by moving the last one into its place.
+	void RemoveSwap(unsigned boid);
+	unsigned GetNumBoids() const { return position.Size(); }
+
+	/// Fill force[] for every live boid from the current position[] and velocity[]. Dead boids get zero.
+	/// With a work queue the boids are split into chunks across its threads. Each force only depends on
+	/// the packed snapshot, so the result is the same for any thread count.
+	/// This only sees the flock's own boids, a FlockWorld steps several flocks against each other.
+	void ComputeForces(WorkQueue* queue = nullptr);
+	/// Move live boids on by timeStep using force[], for flocks that have no rigid bodies.
+	/// Speed is held between the limits Boid::Update applies to bodies and the height is fixed.
+	void Integrate(float timeStep);
+	/// Return the live boid nearest to centre within radius, or M_MAX_UNSIGNED if there is none.
+	/// Uses the grid from the last ComputeForces, widened by how far boids have moved since.
+	unsigned FindNearest(const Vector3& centre, float radius) const;
+
+	/// Fold the live boids' positions and velocities into an FNV-1a hash, bit for bit.
+	/// Two runs that agree on it stepped the same, whatever their thread counts.
+	unsigned GetStateHash(unsigned hash = FLOCK_HASH_BASIS) const;
+
+	/// Orientation of a boid moving along velocity.
+	static Quaternion GetHeading(const Vector3& velocity);
+
+	PODVector<Vector3> position;
+	PODVector<Vector3> velocity;
+	PODVector<Vector3> force;
+	PODVector<bool> alive;
+
+	/// Bin boids into a uniform grid each step instead of testing every pair. A FlockWorld uses its own setting.
+	bool useGrid;
+	/// Species for interactions with other flocks in a FlockWorld, below MAX_FLOCK_SPECIES.
+	unsigned species;
+	/// Species this flock reacts to, one bit each. Other species are skipped in the neighbour pass.
+	unsigned neighbourMask;
+	/// Neighbour loop to use. Falls back to scalar when the requested kernel is not compiled in.
+	FlockKernel kernel;
+
+	static bool IsKernelSupported(FlockKernel requested);
+
+	/// Number of candidate entries the last ComputeForces tested, over all boids. For profiling.
+	unsigned long long GetNumNeighboursVisited() const;
+
+private:
+	friend class FlockIndex;
+	friend class FlockWorld;
+
+	typedef void (Flock::*ForceRangeFunction)(unsigned begin, unsigned end);
+
+	// Live boids' position total and count, for the centre seeking rule
+	void UpdateTotals();
+	// Weights towards each species from one row of a species table, or 1 for all when null, filtered by neighbourMask
+	void SetInteractions(const FlockInteraction* row);
+	// Run the force phase against the current index. Returns true if work items were queued, which the caller must complete.
+	bool QueueForces(WorkQueue* queue);
+	static void ComputeForcesWork(const WorkItem* item, unsigned /*threadIndex*/);
+	// Force phase for boids [begin, end) with one rule set. Only writes force[].
+	template <class Rules> void ComputeForceRangeWith(unsigned begin, unsigned end);
+	// Sum up neighbour terms over packed entries [begin, end). Rule sets with a wide kernel specialise this.
+	template <class Rules> void AccumulateRun(unsigned self, unsigned begin, unsigned end, typename Rules::Sums& sums) const
+	{
+		AccumulateScalar<Rules>(self, begin, end, sums);
+	}
+	template <class Rules> void AccumulateScalar(unsigned self, unsigned begin, unsigned end, typename Rules::Sums& sums) const;
+	template <bool Weighted> void AccumulateSSE(unsigned self, unsigned begin, unsigned end, ClassicFlockRules::Sums& sums) const;
+
+	ForceRangeFunction forceRange;
+	// Largest neighbour radius of the rule set, which the index sizes its grid cells to
+	float neighbourRange;
+	// Index the neighbour pass reads: ownIndex, or the shared one of a FlockWorld
+	const FlockIndex* index;
+	FlockIndex ownIndex;
+	// Global id of boid 0 in the index
+	unsigned indexBase;
+	// Weight towards each species, zero for filtered species
+	FlockInteraction interactions[MAX_FLOCK_SPECIES];
+	// Whether every indexed neighbour has weight 1, so the wide kernel can skip the weights
+	bool uniformWeights;
+	// Furthest any boid can have moved since the index was built
+	float gridDrift;
+	// Candidates tested per boid in the last force phase
+	PODVector<unsigned> visited;
+	// Live boids' position total and count, for the centre seeking rule
+	Vector3 flockSum;
+	unsigned flockCount;
+};
+
+template <> void Flock::AccumulateRun<ClassicFlockRules>(unsigned self, unsigned begin, unsigned end, ClassicFlockRules::Sums& sums) const;
+
+template <class Rules> void Flock::AccumulateScalar(unsigned self, unsigned begin, unsigned end, typename Rules::Sums& sums) const
+{
+	const FlockIndex& idx = *index;
+	const Vector3& pos = position[self];
+	int selfId = (int)(indexBase + self);
+	FlockNeighbour other;
+
+	for (unsigned j = begin; j < end; j++)
+	{
+		if (idx.id[j] == selfId)
+			continue;
+		const FlockInteraction& weight = interactions[idx.species[j]];
+		if (weight.schooling == 0.0f && weight.avoidance == 0.0f)
+			continue;
+		other.position = Vector3(idx.x[j], idx.y[j], idx.z[j]);
+		other.offset = pos - other.position;
+		other.distanceSquared = other.offset.LengthSquared();
+		if (other.distanceSquared >= Rules::Range * Rules::Range)
+			continue;
+		other.velocity = Vector3(idx.vx[j], idx.vy[j], idx.vz[j]);
+		other.schooling = weight.schooling;
+		other.avoidance = weight.avoidance;
+		Rules::Accumulate(sums, other);
+	}
+}
+
+template <class Rules> void Flock::ComputeForceRangeWith(unsigned begin, unsigned end)
+{
+	FlockBoid self;
+	self.flockSum = flockSum;
+	self.flockCount = flockCount;
+
+	for (unsigned i = begin; i < end; i++)
+	{
+		force[i] = Vector3::ZERO;
+		visited[i] = 0;
+		if (!alive[i])
+			continue;
+
+		self.position = position[i];
+		self.velocity = velocity[i];
+		typename Rules::Sums sums;
+		if (Rules::Range > 0.0f)
+		{
+			index->ForEachRun(self.position, Rules::Range, [&](unsigned first, unsigned last) {
+				visited[i] += last - first;
+				AccumulateRun<Rules>(i, first, last, sums);
+			});
+		}
+
+		force[i] = Rules::Steer(sums, self);
+	}
+}
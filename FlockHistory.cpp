@@ -0,0 +1,154 @@
+#include "FlockHistory.h"
+
+// Fixed point steps, positions cover +-512 units around the arena centre
+static const float POSITION_SCALE = 64.0f;
+static const float VELOCITY_SCALE = 2.0f;
+// Boids never go faster than this, it bounds how far one can be from where the live index has it
+static const float MAX_BOID_SPEED = 50.0f;
+
+static inline short QuantisePosition(float value)
+{
+	return (short)Clamp(RoundToInt(value * POSITION_SCALE), -32767, 32767);
+}
+
+static inline signed char QuantiseVelocity(float value)
+{
+	return (signed char)Clamp(RoundToInt(value * VELOCITY_SCALE), -127, 127);
+}
+
+FlockHistory::FlockHistory()
+{
+	sets = nullptr;
+	world = nullptr;
+	slotsPerFrame = 0;
+	newest = 0;
+	numFrames = 0;
+	nextStamp = 1;
+}
+
+void FlockHistory::Initialise(const Vector<SharedPtr<BoidSet> >& boidSets, const FlockWorld& flockWorld, unsigned frameCount)
+{
+	sets = &boidSets;
+	world = &flockWorld;
+
+	setOffset.Resize(boidSets.Size());
+	slotsPerFrame = 0;
+	for (unsigned s = 0; s < boidSets.Size(); s++)
+	{
+		setOffset[s] = slotsPerFrame;
+		slotsPerFrame += boidSets[s]->GetCapacity();
+	}
+
+	frameCount = Max(frameCount, 1U);
+	frames.Resize(frameCount);
+	boids.Resize(frameCount * slotsPerFrame);
+	for (unsigned i = 0; i < boids.Size(); i++)
+		boids[i].stamp = 0;
+	newest = 0;
+	numFrames = 0;
+	nextStamp = 1;
+}
+
+void FlockHistory::Clear()
+{
+	sets = nullptr;
+	world = nullptr;
+	numFrames = 0;
+}
+
+void FlockHistory::Record(float time)
+{
+	if (!sets || frames.Empty())
+		return;
+
+	newest = numFrames ? (newest + 1) % frames.Size() : 0;
+	numFrames = Min(numFrames + 1, frames.Size());
+
+	Frame& frame = frames[newest];
+	frame.time = time;
+	frame.stamp = nextStamp++;
+
+	BoidRecord* block = &boids[newest * slotsPerFrame];
+	for (unsigned s = 0; s < sets->Size(); s++)
+	{
+		const BoidSet& set = *(*sets)[s];
+		const Flock& flock = set.flock;
+		for (unsigned i = 0; i < flock.GetNumBoids(); i++)
+		{
+			BoidHandle handle = set.GetHandle(i);
+			BoidRecord& boid = block[setOffset[s] + handle.slot];
+			boid.x = QuantisePosition(flock.position[i].x_);
+			boid.z = QuantisePosition(flock.position[i].z_);
+			boid.vx = QuantiseVelocity(flock.velocity[i].x_);
+			boid.vz = QuantiseVelocity(flock.velocity[i].z_);
+			boid.generation = (unsigned short)handle.generation;
+			boid.stamp = frame.stamp;
+		}
+	}
+}
+
+unsigned FlockHistory::FindFrame(float time) const
+{
+	if (!numFrames)
+		return M_MAX_UNSIGNED;
+
+	// Walk back from the newest, records are in time order
+	unsigned index = newest;
+	for (unsigned n = 1; n < numFrames && frames[index].time > time; n++)
+		index = (index + frames.Size() - 1) % frames.Size();
+	return index;
+}
+
+float FlockHistory::GetOldestTime() const
+{
+	if (!numFrames)
+		return 0.0f;
+	return frames[(newest + frames.Size() + 1 - numFrames) % frames.Size()].time;
+}
+
+bool FlockHistory::SweepSphere(float time, const Vector3& start, const Vector3& end, float radius, float timeStep, FlockHit& hit) const
+{
+	unsigned f = FindFrame(time);
+	if (f == M_MAX_UNSIGNED)
+		return world && world->SweepSphere(start, end, radius, timeStep, hit);
+
+	hit.flock = nullptr;
+	hit.boid = M_MAX_UNSIGNED;
+	hit.fraction = M_INFINITY;
+
+	const Frame& frame = frames[f];
+	const BoidRecord* block = &boids[f * slotsPerFrame];
+
+	// Candidates come from the live index, so reach as far as a boid can have moved since the record
+	float rewind = frames[newest].time - frame.time + timeStep;
+	Vector3 centre = (start + end) * 0.5f;
+	float reach = (end - start).Length() * 0.5f + radius + MAX_BOID_SPEED * rewind;
+
+	world->ForEachCandidate(centre, reach, [&](Flock* flock, unsigned i) {
+		if (!flock->alive[i])
+			return;
+
+		unsigned s = 0;
+		while (s < sets->Size() && &(*sets)[s]->flock != flock)
+			s++;
+		if (s == sets->Size())
+			return;
+
+		BoidHandle handle = (*sets)[s]->GetHandle(i);
+		const BoidRecord& boid = block[setOffset[s] + handle.slot];
+		if (boid.stamp != frame.stamp || boid.generation != (unsigned short)handle.generation)
+			return;
+
+		// Boids fly level, so the record keeps no height
+		Vector3 position(boid.x / POSITION_SCALE, flock->position[i].y_, boid.z / POSITION_SCALE);
+		Vector3 boidMove = Vector3(boid.vx / VELOCITY_SCALE, 0.0f, boid.vz / VELOCITY_SCALE) * timeStep;
+		float t;
+		if (FlockWorld::SweepTest(start - (position - boidMove), (end - start) - boidMove, radius, t) && t < hit.fraction)
+		{
+			hit.flock = flock;
+			hit.boid = i;
+			hit.fraction = t;
+		}
+	});
+	return hit.flock != nullptr;
+}
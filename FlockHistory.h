@@ -0,0 +1,63 @@
+#pragma once
+#include "BoidSet.h"
+#include "FlockWorld.h"
+
+/// Ring buffer of recent server states, for rewinding a shot to what its client saw.
+/// Each record holds every spawned boid of a list of flocks at one update, quantised to 1/64 unit
+/// on the ground plane with a coarse velocity.
+/// Boids are stored by pool slot, so a record still finds a boid after its flock has been packed.
+class FlockHistory
+{
+public:
+	FlockHistory();
+
+	/// Size the ring for numFrames records of the given flocks. Clears it.
+	/// The flocks must stay alive and keep their capacity while they are recorded.
+	void Initialise(const Vector<SharedPtr<BoidSet> >& sets, const FlockWorld& world, unsigned numFrames);
+	/// Forget every record and flock.
+	void Clear();
+
+	/// Start a record at time with the current state of every flock, replacing the oldest when the ring is full.
+	void Record(float time);
+
+	/// Like FlockWorld::SweepSphere, against the boids as they were in the newest record at or before time.
+	/// Only boids that are still alive can be hit. Falls back to the live flocks when nothing was recorded.
+	bool SweepSphere(float time, const Vector3& start, const Vector3& end, float radius, float timeStep, FlockHit& hit) const;
+
+	/// Time of the oldest record, so how far back shots can be rewound.
+	float GetOldestTime() const;
+	unsigned GetNumFrames() const { return numFrames; }
+
+private:
+	struct Frame
+	{
+		float time;
+		/// Stamp written into every boid recorded in this frame, entries with another stamp are stale.
+		unsigned stamp;
+	};
+
+	struct BoidRecord
+	{
+		short x;
+		short z;
+		signed char vx;
+		signed char vz;
+		unsigned short generation;
+		unsigned stamp;
+	};
+
+	/// Ring index of the newest record at or before time, or the oldest if they are all later. M_MAX_UNSIGNED if empty.
+	unsigned FindFrame(float time) const;
+
+	const Vector<SharedPtr<BoidSet> >* sets;
+	const FlockWorld* world;
+	PODVector<Frame> frames;
+	/// Every frame's boids, a block of each flock's capacity per frame.
+	PODVector<BoidRecord> boids;
+	/// Start of each flock's block within a frame.
+	PODVector<unsigned> setOffset;
+	unsigned slotsPerFrame;
+	unsigned newest;
+	unsigned numFrames;
+	unsigned nextStamp;
+};
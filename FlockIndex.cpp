@@ -0,0 +1,131 @@
+#include "Flock.h"
+#include "FlockIndex.h"
+
+// Loads in the SSE kernel are four wide and may run up to three entries past a run
+static const unsigned PADDING = 3;
+
+// Species as an interaction table row, out of range values share the last row
+static inline int SpeciesOf(const Flock* flock)
+{
+	return (int)Min(flock->species, MAX_FLOCK_SPECIES - 1);
+}
+
+FlockIndex::FlockIndex()
+{
+	gridded = false;
+	singleSpecies = true;
+	numEntries = 0;
+}
+
+void FlockIndex::Build(Flock* const* flocks, unsigned count, bool useGrid)
+{
+	gridded = useGrid;
+	singleSpecies = true;
+
+	unsigned total = 0;
+	float range = 0.0f;
+	for (unsigned f = 0; f < count; ++f)
+	{
+		Flock* flock = flocks[f];
+		flock->indexBase = total;
+		range = Max(range, flock->neighbourRange);
+		flock->gridDrift = 0.0f;
+		total += flock->GetNumBoids();
+		if (SpeciesOf(flock) != SpeciesOf(flocks[0]))
+			singleSpecies = false;
+	}
+
+	// A single flock is indexed straight from its own arrays
+	const Vector3* positions = nullptr;
+	const Vector3* velocities = nullptr;
+	const bool* alive = nullptr;
+	const int* speciesOf = nullptr;
+	if (count == 1)
+	{
+		positions = flocks[0]->position.Buffer();
+		velocities = flocks[0]->velocity.Buffer();
+		alive = flocks[0]->alive.Buffer();
+	}
+	else if (total)
+	{
+		allPositions.Resize(total);
+		allVelocities.Resize(total);
+		allAlive.Resize(total);
+		allSpecies.Resize(total);
+		for (unsigned f = 0; f < count; ++f)
+		{
+			const Flock* flock = flocks[f];
+			unsigned base = flock->indexBase;
+			for (unsigned i = 0; i < flock->GetNumBoids(); ++i)
+			{
+				allPositions[base + i] = flock->position[i];
+				allVelocities[base + i] = flock->velocity[i];
+				allAlive[base + i] = flock->alive[i];
+				allSpecies[base + i] = SpeciesOf(flock);
+			}
+		}
+		positions = allPositions.Buffer();
+		velocities = allVelocities.Buffer();
+		alive = allAlive.Buffer();
+		speciesOf = allSpecies.Buffer();
+	}
+
+	// Cells as wide as the widest query, so each one visits at most three by three cells
+	if (gridded && range > 0.0f)
+		grid.SetCellSize(range);
+	// Built even when empty, so no query walks cells left over from an earlier build
+	if (gridded)
+	{
+		grid.Build(positions, alive, total);
+		numEntries = grid.GetEntries().Size();
+	}
+	else
+	{
+		numEntries = 0;
+		for (unsigned g = 0; g < total; ++g)
+		{
+			if (alive[g])
+				++numEntries;
+		}
+	}
+
+	unsigned padded = numEntries + PADDING;
+	x.Resize(padded);
+	y.Resize(padded);
+	z.Resize(padded);
+	vx.Resize(padded);
+	vy.Resize(padded);
+	vz.Resize(padded);
+	id.Resize(padded);
+	species.Resize(padded);
+
+	int onlySpecies = count ? SpeciesOf(flocks[0]) : 0;
+	unsigned e = 0;
+	for (unsigned g = 0; g < total && e < numEntries; ++g)
+	{
+		unsigned index = g;
+		if (gridded)
+			index = grid.GetEntries()[e];
+		else if (!alive[g])
+			continue;
+
+		x[e] = positions[index].x_;
+		y[e] = positions[index].y_;
+		z[e] = positions[index].z_;
+		vx[e] = velocities[index].x_;
+		vy[e] = velocities[index].y_;
+		vz[e] = velocities[index].z_;
+		id[e] = (int)index;
+		species[e] = speciesOf ? speciesOf[index] : onlySpecies;
+		e++;
+	}
+
+	// The kernels mask padding lanes out, but keep them finite anyway
+	for (; e < padded; e++)
+	{
+		x[e] = y[e] = z[e] = 0.0f;
+		vx[e] = vy[e] = vz[e] = 0.0f;
+		id[e] = -1;
+		species[e] = onlySpecies;
+	}
+}
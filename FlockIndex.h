@@ -0,0 +1,68 @@
+#pragma once
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Vector3.h>
+
+#include "BoidGrid.h"
+
+using namespace Urho3D;
+
+class Flock;
+
+/// Live boids of one or more flocks, binned in a grid with a copy of their state packed in cell order.
+/// Entries carry a global id, which is their flock's base id plus the boid's index in that flock.
+class FlockIndex
+{
+public:
+	FlockIndex();
+
+	/// Rebuild from the live boids of flocks[0..count), giving each flock its base id.
+	/// Without the grid every entry is a candidate for every query.
+	void Build(Flock* const* flocks, unsigned count, bool useGrid);
+
+	/// Call func(begin, end) for each run of packed entries that may be within radius of centre.
+	template <class F> void ForEachRun(const Vector3& centre, float radius, F func) const
+	{
+		if (!numEntries)
+			return;
+		if (gridded)
+			grid.ForEachCandidateRun(centre, radius, func);
+		else
+			func(0, numEntries);
+	}
+
+	/// Call func(id) with the global id of each entry that may be within radius of centre.
+	template <class F> void ForEachCandidate(const Vector3& centre, float radius, F func) const
+	{
+		ForEachRun(centre, radius, [&](unsigned begin, unsigned end) {
+			for (unsigned e = begin; e < end; ++e)
+				func((unsigned)id[e]);
+		});
+	}
+
+	unsigned GetNumEntries() const { return numEntries; }
+	/// Return whether all entries are of one species.
+	bool IsSingleSpecies() const { return singleSpecies; }
+
+	/// Packed entry state. Padded so four wide loads past the last entry stay in bounds.
+	PODVector<float> x;
+	PODVector<float> y;
+	PODVector<float> z;
+	PODVector<float> vx;
+	PODVector<float> vy;
+	PODVector<float> vz;
+	/// Global id of each entry, -1 in the padding.
+	PODVector<int> id;
+	/// Species of each entry's flock.
+	PODVector<int> species;
+
+private:
+	BoidGrid grid;
+	bool gridded;
+	bool singleSpecies;
+	unsigned numEntries;
+	/// All indexed boids end to end, filled only when there is more than one flock.
+	PODVector<Vector3> allPositions;
+	PODVector<Vector3> allVelocities;
+	PODVector<bool> allAlive;
+	PODVector<int> allSpecies;
+};
@@ -0,0 +1,151 @@
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Graphics/Camera.h>
+#include <Urho3D/Graphics/OctreeQuery.h>
+#include <Urho3D/Scene/Scene.h>
+#include <Urho3D/Scene/SceneEvents.h>
+
+#include "Flock.h"
+#include "FlockRenderer.h"
+
+FlockRenderer::FlockRenderer(Context* context) :
+	StaticModel(context),
+	bulkInstances_(false)
+{
+}
+
+FlockRenderer::~FlockRenderer()
+{
+}
+
+void FlockRenderer::RegisterObject(Context* context)
+{
+	context->RegisterFactory<FlockRenderer>(GEOMETRY_CATEGORY);
+
+	URHO3D_COPY_BASE_ATTRIBUTES(StaticModel);
+}
+
+void FlockRenderer::ProcessRayQuery(const RayOctreeQuery& query, PODVector<RayQueryResult>& results)
+{
+	for (unsigned i = 0; i < worldTransforms_.Size(); ++i)
+	{
+		float distance = query.ray_.HitDistance(boundingBox_.Transformed(worldTransforms_[i]));
+		if (distance <= query.maxDistance_)
+		{
+			RayQueryResult result;
+			result.position_ = query.ray_.origin_ + distance * query.ray_.direction_;
+			result.normal_ = -query.ray_.direction_;
+			result.distance_ = distance;
+			result.drawable_ = this;
+			result.node_ = node_;
+			result.subObject_ = i;
+			results.Push(result);
+		}
+	}
+}
+
+void FlockRenderer::UpdateBatches(const FrameInfo& frame)
+{
+	// Getting the world bounding box ensures the instances are accounted for
+	const BoundingBox& worldBoundingBox = GetWorldBoundingBox();
+	distance_ = frame.camera_->GetDistance(worldBoundingBox.Center());
+
+	const Matrix3x4* transforms = worldTransforms_.Size() ? &worldTransforms_[0] : &Matrix3x4::IDENTITY;
+	for (unsigned i = 0; i < batches_.Size(); ++i)
+	{
+		batches_[i].distance_ = distance_;
+		batches_[i].worldTransform_ = transforms;
+		batches_[i].numWorldTransforms_ = worldTransforms_.Size();
+	}
+
+	float scale = worldBoundingBox.Size().DotProduct(DOT_SCALE);
+	float newLodDistance = frame.camera_->GetLodDistance(distance_, scale, lodBias_);
+
+	if (newLodDistance != lodDistance_)
+	{
+		lodDistance_ = newLodDistance;
+		CalculateLodLevels();
+	}
+}
+
+void FlockRenderer::SetInstances(const Flock& flock)
+{
+	bulkInstances_ = true;
+	worldTransforms_.Clear();
+
+	BoundingBox positionBox;
+	for (unsigned i = 0; i < flock.GetNumBoids(); ++i)
+	{
+		if (!flock.alive[i])
+			continue;
+		const Vector3& position = flock.position[i];
+		worldTransforms_.Push(Matrix3x4(position, Flock::GetHeading(flock.velocity[i]), 1.0f));
+		positionBox.Merge(position);
+	}
+
+	FinishInstances(positionBox);
+}
+
+void FlockRenderer::SetInstances(const Vector3* positions, const Quaternion* rotations, unsigned count)
+{
+	bulkInstances_ = true;
+	worldTransforms_.Resize(count);
+
+	BoundingBox positionBox;
+	for (unsigned i = 0; i < count; ++i)
+	{
+		worldTransforms_[i] = Matrix3x4(positions[i], rotations[i], 1.0f);
+		positionBox.Merge(positions[i]);
+	}
+
+	FinishInstances(positionBox);
+}
+
+void FlockRenderer::OnSceneSet(Scene* scene)
+{
+	StaticModel::OnSceneSet(scene);
+
+	if (scene)
+		SubscribeToEvent(scene, E_SCENEPOSTUPDATE, URHO3D_HANDLER(FlockRenderer, HandleScenePostUpdate));
+	else
+		UnsubscribeFromEvent(E_SCENEPOSTUPDATE);
+}
+
+void FlockRenderer::OnWorldBoundingBoxUpdate()
+{
+	worldBoundingBox_ = instanceBox_;
+}
+
+void FlockRenderer::HandleScenePostUpdate(StringHash eventType, VariantMap& eventData)
+{
+	if (bulkInstances_ || !node_)
+		return;
+
+	worldTransforms_.Clear();
+
+	BoundingBox positionBox;
+	const Vector<SharedPtr<Node> >& children = node_->GetChildren();
+	for (unsigned i = 0; i < children.Size(); ++i)
+	{
+		Node* child = children[i];
+		if (!child->IsEnabled())
+			continue;
+		worldTransforms_.Push(child->GetWorldTransform());
+		positionBox.Merge(child->GetWorldPosition());
+	}
+
+	FinishInstances(positionBox);
+}
+
+void FlockRenderer::FinishInstances(const BoundingBox& positionBox)
+{
+	if (positionBox.Defined() && boundingBox_.Defined())
+	{
+		// Any rotation of the model stays within this distance of its origin
+		float reach = boundingBox_.Center().Length() + boundingBox_.HalfSize().Length();
+		instanceBox_ = BoundingBox(positionBox.min_ - Vector3(reach, reach, reach), positionBox.max_ + Vector3(reach, reach, reach));
+	}
+	else
+		instanceBox_ = positionBox;
+
+	OnMarkedDirty(node_);
+}
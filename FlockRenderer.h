@@ -0,0 +1,55 @@
+#pragma once
+#include <Urho3D/Graphics/StaticModel.h>
+
+using namespace Urho3D;
+
+class Flock;
+
+/// Draws a whole flock as one instanced drawable with a single bounding box, instead of one StaticModel per boid.
+/// On the server the instance transforms are written in bulk from the flock arrays with SetInstances.
+/// A client gets the same from flock snapshots. Until SetInstances is called it draws its enabled child nodes.
+class FlockRenderer : public StaticModel
+{
+	URHO3D_OBJECT(FlockRenderer, StaticModel);
+
+public:
+	/// Construct.
+	FlockRenderer(Context* context);
+	/// Destruct.
+	virtual ~FlockRenderer();
+	/// Register object factory. Model and material attributes come from StaticModel.
+	static void RegisterObject(Context* context);
+
+	/// Process octree raycast against each instance's bounding box.
+	virtual void ProcessRayQuery(const RayOctreeQuery& query, PODVector<RayQueryResult>& results);
+	/// Calculate distance and prepare batches for rendering.
+	virtual void UpdateBatches(const FrameInfo& frame);
+	/// Boids are never used as occluders.
+	virtual unsigned GetNumOccluderTriangles() { return 0; }
+
+	/// Replace the instances with one per live boid, facing along its velocity.
+	void SetInstances(const Flock& flock);
+	/// Replace the instances with count given placements, as a client receives them.
+	void SetInstances(const Vector3* positions, const Quaternion* rotations, unsigned count);
+	/// Return number of instances drawn.
+	unsigned GetNumInstances() const { return worldTransforms_.Size(); }
+
+protected:
+	/// Handle scene being assigned.
+	virtual void OnSceneSet(Scene* scene);
+	/// Recalculate the world-space bounding box.
+	virtual void OnWorldBoundingBoxUpdate();
+
+private:
+	/// Rebuild the instances from the child nodes when no flock is feeding them.
+	void HandleScenePostUpdate(StringHash eventType, VariantMap& eventData);
+	/// Grow the instance position bounds to cover the model and mark the drawable dirty.
+	void FinishInstances(const BoundingBox& positionBox);
+
+	/// Instance world transforms.
+	PODVector<Matrix3x4> worldTransforms_;
+	/// Bounding box of all instances.
+	BoundingBox instanceBox_;
+	/// Whether SetInstances has been used, after which child nodes are ignored.
+	bool bulkInstances_;
+};
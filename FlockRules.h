@@ -0,0 +1,231 @@
+#pragma once
+#include <Urho3D/Math/Vector3.h>
+
+using namespace Urho3D;
+
+/// Species a flock can belong to, so a species mask fits in an unsigned.
+static const unsigned MAX_FLOCK_SPECIES = 32;
+
+/// How strongly boids react to boids of another species.
+struct FlockInteraction
+{
+	/// Weight in cohesion and alignment.
+	float schooling;
+	/// Weight in separation.
+	float avoidance;
+};
+
+/// The boid a force is being computed for, plus flock wide totals.
+struct FlockBoid
+{
+	Vector3 position;
+	Vector3 velocity;
+	/// Sum of every live boid's position, this one included.
+	Vector3 flockSum;
+	unsigned flockCount;
+};
+
+/// One candidate neighbour as seen from the boid being steered.
+struct FlockNeighbour
+{
+	Vector3 position;
+	Vector3 velocity;
+	/// Steered boid's position minus the neighbour's.
+	Vector3 offset;
+	float distanceSquared;
+	/// Interaction weights between the two boids' species, 1 within a species.
+	float schooling;
+	float avoidance;
+};
+
+/// Largest neighbour radius of a list of rules.
+template <class... Rules> struct FlockRuleRange
+{
+	static constexpr float value = 0.0f;
+};
+
+template <class Rule, class... Rest> struct FlockRuleRange<Rule, Rest...>
+{
+	static constexpr float value = Rule::Range > FlockRuleRange<Rest...>::value ? Rule::Range : FlockRuleRange<Rest...>::value;
+};
+
+/// A flock type is a list of rule policies. Every rule provides:
+///   static constexpr float Range - neighbour radius, 0 if the rule ignores neighbours
+///   struct Sums - per boid accumulator, default constructed to empty
+///   static void Accumulate(Sums&, const FlockNeighbour&) - called for candidates inside Range
+///   static Vector3 Steer(const Sums&, const FlockBoid&) - force contribution
+///   static void Constrain(Vector3& force) - applied to the summed force, in rule order
+/// FlockRules fuses them into one neighbour pass at the largest range. Ranges and factors are
+/// compile-time constants, so each flock type gets its own loop with the tests folded in.
+template <class... Rules> struct FlockRules
+{
+	struct Sums : Rules::Sums... {};
+
+	static constexpr float Range = FlockRuleRange<Rules...>::value;
+
+	static inline void Accumulate(Sums& sums, const FlockNeighbour& other)
+	{
+		int expand[] = { 0, (AccumulateRule<Rules>(sums, other), 0)... };
+		(void)expand;
+	}
+
+	static inline Vector3 Steer(const Sums& sums, const FlockBoid& self)
+	{
+		Vector3 force = Vector3::ZERO;
+		int steer[] = { 0, (force += Rules::Steer(sums, self), 0)... };
+		int constrain[] = { 0, (Rules::Constrain(force), 0)... };
+		(void)steer;
+		(void)constrain;
+		return force;
+	}
+
+private:
+	template <class Rule> static inline void AccumulateRule(Sums& sums, const FlockNeighbour& other)
+	{
+		if (Rule::Range > 0.0f && other.distanceSquared < Rule::Range * Rule::Range)
+			Rule::Accumulate(sums, other);
+	}
+};
+
+/// Steer towards the centre of mass of neighbours within range, weighted by schooling.
+template <class Tuning> struct Cohesion
+{
+	static constexpr float Range = Tuning::CohesionRange;
+
+	struct Sums
+	{
+		Vector3 centre = Vector3::ZERO;
+		float cohesionCount = 0.0f;
+	};
+
+	static inline void Accumulate(Sums& sums, const FlockNeighbour& other)
+	{
+		sums.centre += other.position * other.schooling;
+		sums.cohesionCount += other.schooling;
+	}
+
+	static inline Vector3 Steer(const Sums& sums, const FlockBoid& self)
+	{
+		if (sums.cohesionCount <= 0.0f)
+			return Vector3::ZERO;
+		Vector3 dir = (sums.centre / sums.cohesionCount - self.position).Normalized();
+		return (dir * Tuning::CohesionSpeed - self.velocity) * Tuning::CohesionFactor;
+	}
+
+	static inline void Constrain(Vector3&) {}
+};
+
+/// Push away from every neighbour within range, each by a unit vector scaled by avoidance.
+template <class Tuning> struct Separation
+{
+	static constexpr float Range = Tuning::SeparationRange;
+
+	struct Sums
+	{
+		Vector3 away = Vector3::ZERO;
+	};
+
+	static inline void Accumulate(Sums& sums, const FlockNeighbour& other)
+	{
+		if (other.distanceSquared > 0.0f)
+			sums.away += other.offset * (other.avoidance / Sqrt(other.distanceSquared));
+	}
+
+	static inline Vector3 Steer(const Sums& sums, const FlockBoid&)
+	{
+		return sums.away * Tuning::SeparationFactor;
+	}
+
+	static inline void Constrain(Vector3&) {}
+};
+
+/// Match the average velocity of neighbours within range, weighted by schooling.
+template <class Tuning> struct Alignment
+{
+	static constexpr float Range = Tuning::AlignmentRange;
+
+	struct Sums
+	{
+		Vector3 heading = Vector3::ZERO;
+		float alignmentCount = 0.0f;
+	};
+
+	static inline void Accumulate(Sums& sums, const FlockNeighbour& other)
+	{
+		sums.heading += other.velocity * other.schooling;
+		sums.alignmentCount += other.schooling;
+	}
+
+	static inline Vector3 Steer(const Sums& sums, const FlockBoid& self)
+	{
+		if (sums.alignmentCount <= 0.0f)
+			return Vector3::ZERO;
+		return (sums.heading / sums.alignmentCount - self.velocity) * Tuning::AlignmentFactor;
+	}
+
+	static inline void Constrain(Vector3&) {}
+};
+
+/// Alignment as the original fused force loop computed it, which the game's flocks keep. The summed heading is
+/// averaged over the cohesion neighbours rather than its own, and a boid with none is pulled towards standing
+/// still. Steer takes the fused sums of the whole rule list for the cohesion count, so Cohesion must be in it.
+template <class Tuning> struct FusedAlignment : Alignment<Tuning>
+{
+	template <class FusedSums> static inline Vector3 Steer(const FusedSums& sums, const FlockBoid& self)
+	{
+		Vector3 heading = sums.cohesionCount > 0.0f ? sums.heading / sums.cohesionCount : sums.heading;
+		return (heading - self.velocity) * Tuning::AlignmentFactor;
+	}
+};
+
+/// Boids that stray close to the arena centre head for the rest of the flock, so it doesn't clump there.
+template <class Tuning> struct CentreSeeking
+{
+	static constexpr float Range = 0.0f;
+
+	struct Sums {};
+
+	static inline void Accumulate(Sums&, const FlockNeighbour&) {}
+
+	static inline Vector3 Steer(const Sums&, const FlockBoid& self)
+	{
+		int others = (int)self.flockCount - 1;
+		if (others <= 0 || self.position.LengthSquared() >= Tuning::CentreRadius * Tuning::CentreRadius)
+			return Vector3::ZERO;
+		Vector3 centre = (self.flockSum - self.position) / (float)others;
+		Vector3 dir = (centre - self.position).Normalized();
+		return (dir * Tuning::CentreSpeed - self.velocity) * Tuning::CentreFactor;
+	}
+
+	static inline void Constrain(Vector3&) {}
+};
+
+/// Keep the flock on the ground plane by dropping the vertical force.
+struct PlanarConstraint
+{
+	static constexpr float Range = 0.0f;
+
+	struct Sums {};
+
+	static inline void Accumulate(Sums&, const FlockNeighbour&) {}
+	static inline Vector3 Steer(const Sums&, const FlockBoid&) { return Vector3::ZERO; }
+	static inline void Constrain(Vector3& force) { force.y_ = 0.0f; }
+};
+
+/// Tuning of the flocks the game spawns.
+struct ClassicFlockTuning
+{
+	static constexpr float CohesionRange = 60.0f;
+	static constexpr float CohesionSpeed = 5.0f;
+	static constexpr float CohesionFactor = 8.0f;
+	static constexpr float SeparationRange = 40.0f;
+	static constexpr float SeparationFactor = 8.0f;
+	static constexpr float AlignmentRange = 10.0f;
+	static constexpr float AlignmentFactor = 4.0f;
+	static constexpr float CentreRadius = 10.0f;
+	static constexpr float CentreSpeed = 5.0f;
+	static constexpr float CentreFactor = 8.0f;
+};
+
+typedef FlockRules<Cohesion<ClassicFlockTuning>, Separation<ClassicFlockTuning>, FusedAlignment<ClassicFlockTuning>,
+	CentreSeeking<ClassicFlockTuning>, PlanarConstraint> ClassicFlockRules;
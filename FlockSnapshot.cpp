@@ -0,0 +1,1044 @@
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/Network/Connection.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "FlockRenderer.h"
+#include "FlockSnapshot.h"
+
+// Quarter unit steps, positions cover +-4096 units so a delta always fits 16 bits
+static const float POSITION_SCALE = 4.0f;
+static const int MAX_POSITION = 16383;
+// Height clients draw the flocks at, which the flocks keep to
+static const float SNAPSHOT_HEIGHT = 1.5f;
+// Pool slots per message, a chunk sent in full still fits one packet
+static const unsigned CHUNK_SLOTS = 128;
+// Sends kept as baselines. An acknowledgement older than this gets the chunk sent in full
+static const unsigned SNAPSHOT_HISTORY = 16;
+// Sends between sorts of the snapshot slots. In between chunks spread as their boids fly apart
+static const unsigned SORT_INTERVAL = 10;
+// Whether the slots are sorted into chunks on this send
+static inline bool IsSortSequence(unsigned sequence)
+{
+	return sequence % SORT_INTERVAL == 1;
+}
+
+// Bits of a slot's occupant count on the wire. Two states of a slot more than this many occupants apart look alike
+static const unsigned OCCUPANT_BITS = 3;
+// Bits per axis of each position error width, picked per boid by a unary prefix as narrow errors are the most common
+static const unsigned DELTA_BITS[] = { 0, 2, 5, 16 };
+static const unsigned NUM_DELTA_WIDTHS = 4;
+// Steps of a full turn in a heading. Clients blend headings between states, so coarse steps do not show
+static const unsigned HEADING_STEPS = 64;
+static const unsigned HEADING_BITS = 6;
+// Turns of two to MAX_SHORT_TURN steps are sent as their size in this many bits
+static const unsigned SHORT_TURN_BITS = 2;
+static const unsigned MAX_SHORT_TURN = (1 << SHORT_TURN_BITS) + 1;
+// Speed changes up to this many bits are sent as deltas, larger ones as the value itself
+static const unsigned SMALL_DELTA_BITS = 4;
+// Fixed point of the heading table, predictions are integer so both ends get the same result
+static const int DIRECTION_ONE = 1 << 14;
+// Acknowledgements per message, to stay inside one packet
+static const unsigned ACKS_PER_MESSAGE = 100;
+// Share of the gap a later snapshot closes when it says the server clock is behind the client's estimate,
+// slow so a late packet hardly moves it but clock drift is followed
+static const float CLOCK_SETTLE = 0.01f;
+
+static const BoidSnapshot ABSENT = { 0, 0, 0, 0, 0, false };
+
+// Unit direction of each heading, x then z
+struct DirectionTable
+{
+	DirectionTable()
+	{
+		for (unsigned h = 0; h < HEADING_STEPS; ++h)
+		{
+			float angle = h * (360.0f / HEADING_STEPS);
+			x[h] = RoundToInt(Sin(angle) * DIRECTION_ONE);
+			z[h] = RoundToInt(Cos(angle) * DIRECTION_ONE);
+		}
+	}
+
+	int x[HEADING_STEPS];
+	int z[HEADING_STEPS];
+};
+
+static const DirectionTable directions;
+
+// Packs values of up to 16 bits, least significant bit first
+class BitWriter
+{
+public:
+	BitWriter(PODVector<unsigned char>& bytes) :
+		bytes(bytes),
+		scratch(0),
+		scratchBits(0)
+	{
+		bytes.Clear();
+	}
+
+	void Write(unsigned value, unsigned count)
+	{
+		scratch |= value << scratchBits;
+		scratchBits += count;
+		while (scratchBits >= 8)
+		{
+			bytes.Push((unsigned char)scratch);
+			scratch >>= 8;
+			scratchBits -= 8;
+		}
+	}
+
+	void Flush()
+	{
+		if (scratchBits)
+			bytes.Push((unsigned char)scratch);
+		scratch = 0;
+		scratchBits = 0;
+	}
+
+private:
+	PODVector<unsigned char>& bytes;
+	unsigned scratch;
+	unsigned scratchBits;
+};
+
+class BitReader
+{
+public:
+	BitReader(const unsigned char* data, unsigned size) :
+		data(data),
+		size(size),
+		scratch(0),
+		scratchBits(0),
+		overrun(false)
+	{
+	}
+
+	unsigned Read(unsigned count)
+	{
+		while (scratchBits < count)
+		{
+			if (!size)
+			{
+				overrun = true;
+				return 0;
+			}
+			scratch |= (unsigned)*data++ << scratchBits;
+			scratchBits += 8;
+			--size;
+		}
+		unsigned value = scratch & ((1u << count) - 1);
+		scratch >>= count;
+		scratchBits -= count;
+		return value;
+	}
+
+	bool IsOverrun() const { return overrun; }
+
+private:
+	const unsigned char* data;
+	unsigned size;
+	unsigned scratch;
+	unsigned scratchBits;
+	bool overrun;
+};
+
+static inline unsigned ZigZag(int value)
+{
+	return ((unsigned)value << 1) ^ (unsigned)(value >> 31);
+}
+
+static inline int UnZigZag(unsigned value)
+{
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+static inline bool SameState(const BoidSnapshot& a, const BoidSnapshot& b)
+{
+	return a.present == b.present && (!a.present || (a.x == b.x && a.z == b.z && a.heading == b.heading && a.speed == b.speed &&
+		a.occupant == b.occupant));
+}
+
+// Where a boid would be after elapsedMs, flying at the mean of two speeds along the mean of two directions.
+// A boid turning between states covers the chord of its turn, which the mean of its old and new heading follows
+static inline int Predict(short position, unsigned speedSum, int directionSum, unsigned elapsedMs)
+{
+	long long scale = (long long)DIRECTION_ONE * 4000;
+	long long moved = (long long)speedSum * directionSum * elapsedMs;
+	long long offset = (moved + (moved >= 0 ? scale / 2 : -scale / 2)) / scale;
+	return Clamp(position + (int)offset, -MAX_POSITION, MAX_POSITION);
+}
+
+// Signed turn from one heading to another, the short way round
+static inline int HeadingTurn(unsigned char from, unsigned char to)
+{
+	return (int)((to - from + HEADING_STEPS / 2) & (HEADING_STEPS - 1)) - (int)(HEADING_STEPS / 2);
+}
+
+// A heading as no turn, a turn of one step, a turn of up to MAX_SHORT_TURN steps, or in full.
+// Between sends boids mostly turn a few steps, and the odds fall by about half with every step
+static inline void EncodeHeading(BitWriter& writer, unsigned char value, unsigned char base)
+{
+	int turn = HeadingTurn(base, value);
+	unsigned size = (unsigned)Abs(turn);
+	if (!size)
+	{
+		writer.Write(0, 1);
+		return;
+	}
+	writer.Write(1, 1);
+	if (size == 1)
+	{
+		writer.Write(0, 1);
+		writer.Write(turn > 0 ? 1 : 0, 1);
+		return;
+	}
+	writer.Write(1, 1);
+	if (size <= MAX_SHORT_TURN)
+	{
+		writer.Write(0, 1);
+		writer.Write(turn > 0 ? 1 : 0, 1);
+		writer.Write(size - 2, SHORT_TURN_BITS);
+	}
+	else
+	{
+		writer.Write(1, 1);
+		writer.Write(value, HEADING_BITS);
+	}
+}
+
+static inline unsigned char DecodeHeading(BitReader& reader, unsigned char base)
+{
+	if (!reader.Read(1))
+		return base;
+	int turn;
+	if (!reader.Read(1))
+		turn = reader.Read(1) ? 1 : -1;
+	else if (!reader.Read(1))
+	{
+		bool left = reader.Read(1) != 0;
+		int size = (int)reader.Read(SHORT_TURN_BITS) + 2;
+		turn = left ? size : -size;
+	}
+	else
+		return (unsigned char)reader.Read(HEADING_BITS);
+	return (unsigned char)((base + turn) & (HEADING_STEPS - 1));
+}
+
+// A speed as a small delta, or in full
+static inline void EncodeByte(BitWriter& writer, unsigned char value, unsigned char base)
+{
+	unsigned delta = ZigZag((signed char)(value - base));
+	if (!delta)
+	{
+		writer.Write(0, 1);
+		return;
+	}
+	writer.Write(1, 1);
+	if (delta >> SMALL_DELTA_BITS)
+	{
+		writer.Write(1, 1);
+		writer.Write(value, 8);
+	}
+	else
+	{
+		writer.Write(0, 1);
+		writer.Write(delta, SMALL_DELTA_BITS);
+	}
+}
+
+static inline unsigned char DecodeByte(BitReader& reader, unsigned char base)
+{
+	if (!reader.Read(1))
+		return base;
+	if (reader.Read(1))
+		return (unsigned char)reader.Read(8);
+	return (unsigned char)(base + UnZigZag(reader.Read(SMALL_DELTA_BITS)));
+}
+
+// Spread the low 16 bits of value to the even bits, for interleaving two coordinates
+static inline unsigned SpreadBits(unsigned value)
+{
+	value &= 0xffff;
+	value = (value | (value << 8)) & 0x00ff00ff;
+	value = (value | (value << 4)) & 0x0f0f0f0f;
+	value = (value | (value << 2)) & 0x33333333;
+	value = (value | (value << 1)) & 0x55555555;
+	return value;
+}
+
+// Position along a Z-order curve over the quantised ground plane, so boids close on the curve are close on the ground
+static inline unsigned CurveKey(const Vector3& position)
+{
+	unsigned x = (unsigned)(Clamp(RoundToInt(position.x_ * POSITION_SCALE), -MAX_POSITION, MAX_POSITION) + MAX_POSITION);
+	unsigned z = (unsigned)(Clamp(RoundToInt(position.z_ * POSITION_SCALE), -MAX_POSITION, MAX_POSITION) + MAX_POSITION);
+	return SpreadBits(x) | (SpreadBits(z) << 1);
+}
+
+static inline BoidSnapshot Quantise(const Vector3& position, const Vector3& velocity)
+{
+	BoidSnapshot boid;
+	boid.x = (short)Clamp(RoundToInt(position.x_ * POSITION_SCALE), -MAX_POSITION, MAX_POSITION);
+	boid.z = (short)Clamp(RoundToInt(position.z_ * POSITION_SCALE), -MAX_POSITION, MAX_POSITION);
+	boid.heading = (unsigned char)(RoundToInt(Atan2(velocity.x_, velocity.z_) * (HEADING_STEPS / 360.0f)) & (HEADING_STEPS - 1));
+	boid.speed = (unsigned char)Clamp(RoundToInt(velocity.Length() * POSITION_SCALE), 0, 255);
+	boid.occupant = 0;
+	boid.present = true;
+	return boid;
+}
+
+// Write one slot against its baseline from elapsedMs before. Returns whether it changed
+static bool EncodeBoid(BitWriter& writer, const BoidSnapshot& boid, const BoidSnapshot& base, unsigned elapsedMs)
+{
+	bool same = SameState(boid, base);
+	// A live slot most often holds the same boid moved on, which takes one bit to say. Then come a slot
+	// left as it was, one whose boid has gone and one given to another boid
+	if (base.present)
+	{
+		bool moved = !same && boid.present && boid.occupant == base.occupant;
+		writer.Write(moved ? 0 : 1, 1);
+		if (!moved)
+		{
+			writer.Write(same ? 0 : 1, 1);
+			if (same)
+				return false;
+			writer.Write(boid.present ? 1 : 0, 1);
+			if (!boid.present)
+				return true;
+		}
+	}
+	// An empty slot can only stay empty or take a boid
+	else
+	{
+		writer.Write(same ? 0 : 1, 1);
+		if (same)
+			return false;
+	}
+
+	// Another boid than the baseline's is sent in full, predicting it from the old one would only cost bits
+	if (!base.present || boid.occupant != base.occupant)
+	{
+		writer.Write(boid.occupant, OCCUPANT_BITS);
+		writer.Write((unsigned short)boid.x, 16);
+		writer.Write((unsigned short)boid.z, 16);
+		writer.Write(boid.heading, HEADING_BITS);
+		writer.Write(boid.speed, 8);
+		return true;
+	}
+
+	// Motion first, the position is predicted from both ends of it
+	EncodeHeading(writer, boid.heading, base.heading);
+	EncodeByte(writer, boid.speed, base.speed);
+
+	unsigned speedSum = base.speed + boid.speed;
+	unsigned dx = ZigZag(boid.x - Predict(base.x, speedSum, directions.x[base.heading] + directions.x[boid.heading], elapsedMs));
+	unsigned dz = ZigZag(boid.z - Predict(base.z, speedSum, directions.z[base.heading] + directions.z[boid.heading], elapsedMs));
+	unsigned widest = Max(dx, dz);
+	unsigned width = 0;
+	while (widest >> DELTA_BITS[width])
+		++width;
+	for (unsigned w = 0; w < width; ++w)
+		writer.Write(1, 1);
+	if (width + 1 < NUM_DELTA_WIDTHS)
+		writer.Write(0, 1);
+	writer.Write(dx, DELTA_BITS[width]);
+	writer.Write(dz, DELTA_BITS[width]);
+	return true;
+}
+
+static void DecodeBoid(BitReader& reader, const BoidSnapshot& base, unsigned elapsedMs, BoidSnapshot& boid)
+{
+	bool moved = base.present && !reader.Read(1);
+	if (!moved)
+	{
+		if (!reader.Read(1))
+		{
+			boid = base;
+			return;
+		}
+		if (base.present && !reader.Read(1))
+		{
+			boid = ABSENT;
+			return;
+		}
+		boid.present = true;
+		boid.occupant = (unsigned char)reader.Read(OCCUPANT_BITS);
+		boid.x = (short)reader.Read(16);
+		boid.z = (short)reader.Read(16);
+		boid.heading = (unsigned char)reader.Read(HEADING_BITS);
+		boid.speed = (unsigned char)reader.Read(8);
+		return;
+	}
+
+	boid.present = true;
+	boid.heading = DecodeHeading(reader, base.heading);
+	boid.speed = DecodeByte(reader, base.speed);
+	boid.occupant = base.occupant;
+
+	unsigned width = 0;
+	while (width + 1 < NUM_DELTA_WIDTHS && reader.Read(1))
+		++width;
+	unsigned speedSum = base.speed + boid.speed;
+	boid.x = (short)(Predict(base.x, speedSum, directions.x[base.heading] + directions.x[boid.heading], elapsedMs) +
+		UnZigZag(reader.Read(DELTA_BITS[width])));
+	boid.z = (short)(Predict(base.z, speedSum, directions.z[base.heading] + directions.z[boid.heading], elapsedMs) +
+		UnZigZag(reader.Read(DELTA_BITS[width])));
+}
+
+FlockSnapshotSender::FlockSnapshotSender()
+{
+	sets = nullptr;
+	numChunks = 0;
+	sequence = 0;
+	bytesSent = 0;
+	interest = INTEREST_UNLIMITED;
+	maxChunkRadius = 0.0f;
+}
+
+void FlockSnapshotSender::Initialise(const Vector<SharedPtr<BoidSet> >& boidSets)
+{
+	Clear();
+	sets = &boidSets;
+	sendTime.Resize(SNAPSHOT_HISTORY);
+
+	flocks.Resize(boidSets.Size());
+	for (unsigned f = 0; f < boidSets.Size(); ++f)
+	{
+		FlockState& state = flocks[f];
+		state.node = boidSets[f]->pNode;
+		state.capacity = boidSets[f]->GetCapacity();
+		state.numChunks = (state.capacity + CHUNK_SLOTS - 1) / CHUNK_SLOTS;
+		state.firstChunk = numChunks;
+		state.history.Resize(SNAPSHOT_HISTORY * state.capacity);
+		state.historySequence.Resize(SNAPSHOT_HISTORY);
+		for (unsigned h = 0; h < SNAPSHOT_HISTORY; ++h)
+			state.historySequence[h] = 0;
+		state.slotOfPool.Resize(state.capacity);
+		state.poolOfSlot.Resize(state.capacity);
+		state.generation.Resize(state.capacity);
+		state.seen.Resize(state.capacity);
+		state.occupant.Resize(state.capacity);
+		for (unsigned s = 0; s < state.capacity; ++s)
+		{
+			state.slotOfPool[s] = M_MAX_UNSIGNED;
+			state.poolOfSlot[s] = M_MAX_UNSIGNED;
+			state.generation[s] = 0;
+			state.seen[s] = 0;
+			state.occupant[s] = 0;
+		}
+		numChunks += state.numChunks;
+	}
+
+	chunkCentre.Resize(numChunks);
+	chunkRadius.Resize(numChunks);
+	chunkLive.Resize(numChunks);
+	chunkBand.Resize(numChunks);
+	for (unsigned g = 0; g < numChunks; ++g)
+		chunkLive[g] = false;
+}
+
+void FlockSnapshotSender::Clear()
+{
+	sets = nullptr;
+	flocks.Clear();
+	clients.Clear();
+	measureView.acked.Clear();
+	measureView.inView.Clear();
+	sendTime.Clear();
+	numChunks = 0;
+	sequence = 0;
+	bytesSent = 0;
+	chunkCentre.Clear();
+	chunkRadius.Clear();
+	chunkLive.Clear();
+	chunkBand.Clear();
+}
+
+void FlockSnapshotSender::SetInterest(const InterestRange& range)
+{
+	interest = range;
+	interest.farInterval = Max(range.farInterval, 1U);
+	// A client's range covers a handful of cells
+	if (interest.nearDistance < M_INFINITY)
+		chunkGrid.SetCellSize(interest.nearDistance);
+}
+
+void FlockSnapshotSender::Send(const Vector<SharedPtr<Connection> >& connections, float time)
+{
+	if (!TakeSnapshot(time))
+		return;
+
+	// Forget clients that have gone
+	for (HashMap<Connection*, ClientView>::Iterator i = clients.Begin(); i != clients.End();)
+	{
+		bool connected = false;
+		for (unsigned c = 0; c < connections.Size() && !connected; ++c)
+			connected = connections[c].Get() == i->first_;
+		if (connected)
+			++i;
+		else
+			i = clients.Erase(i);
+	}
+
+	for (unsigned c = 0; c < connections.Size(); ++c)
+	{
+		Connection* connection = connections[c];
+		// Until then the client has no flock nodes to draw with
+		if (!connection->IsSceneLoaded())
+			continue;
+		bytesSent += SendTo(connection, clients[connection], connection->GetPosition(), time);
+	}
+}
+
+unsigned FlockSnapshotSender::MeasureSend(const Vector3& position, float time)
+{
+	if (!TakeSnapshot(time))
+		return 0;
+	return SendTo(0, measureView, position, time);
+}
+
+bool FlockSnapshotSender::TakeSnapshot(float time)
+{
+	if (!sets || flocks.Empty())
+		return false;
+
+	++sequence;
+	sendTime[sequence % SNAPSHOT_HISTORY] = time;
+	for (unsigned f = 0; f < flocks.Size(); ++f)
+		Capture(flocks[f], *(*sets)[f], sequence);
+
+	maxChunkRadius = 0.0f;
+	for (unsigned g = 0; g < numChunks; ++g)
+	{
+		if (chunkLive[g])
+			maxChunkRadius = Max(maxChunkRadius, chunkRadius[g]);
+	}
+	chunkGrid.Build(chunkCentre.Buffer(), chunkLive.Buffer(), numChunks);
+	return true;
+}
+
+unsigned FlockSnapshotSender::SendTo(Connection* connection, ClientView& view, const Vector3& position, float time)
+{
+	if (view.acked.Size() != numChunks)
+	{
+		view.acked.Resize(numChunks);
+		view.inView.Resize(numChunks);
+		for (unsigned g = 0; g < numChunks; ++g)
+		{
+			view.acked[g] = 0;
+			view.inView[g] = false;
+		}
+	}
+
+	FindBands(position);
+
+	unsigned bytes = 0;
+	for (unsigned f = 0; f < flocks.Size(); ++f)
+	{
+		const FlockState& state = flocks[f];
+		if (!state.node)
+			continue;
+
+		const BoidSnapshot* current = GetHistory(state, sequence);
+		for (unsigned k = 0; k < state.numChunks; ++k)
+		{
+			unsigned g = state.firstChunk + k;
+			if (chunkBand[g] == BAND_NONE)
+			{
+				if (view.inView[g])
+				{
+					message.Clear();
+					message.WriteUInt(state.node->GetID());
+					message.WriteVLE(k);
+					message.WriteUInt(sequence);
+					if (connection)
+						SendNetMessage(connection, MSG_FLOCK_DROP, message);
+					bytes += message.GetSize();
+					view.inView[g] = false;
+				}
+				continue;
+			}
+			// Far chunks take turns, so each send carries a share of them. Except on a sort, boids moved
+			// between chunks must leave one and arrive in the other together
+			if (chunkBand[g] == BAND_FAR && (sequence + g) % interest.farInterval && !IsSortSequence(sequence))
+				continue;
+
+			unsigned first = k * CHUNK_SLOTS;
+			unsigned count = Min(CHUNK_SLOTS, state.capacity - first);
+			unsigned baseline = view.acked[g];
+			const BoidSnapshot* base = GetHistory(state, baseline);
+			if (!base)
+				baseline = 0;
+			// Sent rather than derived from the sequences, so both ends predict from the same number
+			unsigned elapsedMs = base ? (unsigned)RoundToInt((time - sendTime[baseline % SNAPSHOT_HISTORY]) * 1000.0f) : 0;
+
+			bool changed = false;
+			BitWriter writer(bits);
+			for (unsigned i = 0; i < count; ++i)
+				changed |= EncodeBoid(writer, current[first + i], base ? base[first + i] : ABSENT, elapsedMs);
+			writer.Flush();
+
+			// The client already has this chunk as it is
+			if (base && !changed && view.inView[g])
+				continue;
+
+			message.Clear();
+			message.WriteUInt(state.node->GetID());
+			message.WriteVLE(k);
+			message.WriteUInt(sequence);
+			message.WriteFloat(time);
+			message.WriteUInt(baseline);
+			message.WriteVLE(elapsedMs);
+			message.WriteVLE(count);
+			message.Write(bits.Buffer(), bits.Size());
+			if (connection)
+				SendNetMessage(connection, MSG_FLOCK_SNAPSHOT, message);
+			// A measurement has no client to acknowledge it, so take it as delivered
+			else
+				view.acked[g] = sequence;
+			bytes += message.GetSize();
+			view.inView[g] = true;
+		}
+	}
+	return bytes;
+}
+
+void FlockSnapshotSender::HandleAck(Connection* connection, MemoryBuffer& ack)
+{
+	HashMap<Connection*, ClientView>::Iterator client = clients.Find(connection);
+	if (client == clients.End())
+		return;
+
+	PODVector<unsigned>& acks = client->second_.acked;
+	unsigned count = ack.ReadVLE();
+	for (unsigned a = 0; a < count && !ack.IsEof(); ++a)
+	{
+		unsigned nodeID = ack.ReadUInt();
+		unsigned chunk = ack.ReadVLE();
+		unsigned acked = ack.ReadUInt();
+		if (acked > sequence)
+			continue;
+
+		for (unsigned f = 0; f < flocks.Size(); ++f)
+		{
+			const FlockState& state = flocks[f];
+			if (!state.node || state.node->GetID() != nodeID || chunk >= state.numChunks)
+				continue;
+			unsigned& newest = acks[state.firstChunk + chunk];
+			newest = Max(newest, acked);
+		}
+	}
+}
+
+void FlockSnapshotSender::Capture(FlockState& state, const BoidSet& set, unsigned captured)
+{
+	unsigned block = captured % SNAPSHOT_HISTORY;
+	state.historySequence[block] = captured;
+
+	AssignSlots(state, set, captured);
+
+	BoidSnapshot* states = &state.history[block * state.capacity];
+	for (unsigned s = 0; s < state.capacity; ++s)
+		states[s] = ABSENT;
+
+	const Flock& flock = set.flock;
+	for (unsigned i = 0; i < flock.GetNumBoids(); ++i)
+	{
+		if (!flock.alive[i])
+			continue;
+		unsigned slot = state.slotOfPool[set.GetHandle(i).slot];
+		states[slot] = Quantise(flock.position[i], flock.velocity[i]);
+		states[slot].occupant = state.occupant[slot];
+	}
+
+	for (unsigned k = 0; k < state.numChunks; ++k)
+	{
+		unsigned g = state.firstChunk + k;
+		unsigned first = k * CHUNK_SLOTS;
+		unsigned last = Min(first + CHUNK_SLOTS, state.capacity);
+		int minX = MAX_POSITION, minZ = MAX_POSITION, maxX = -MAX_POSITION, maxZ = -MAX_POSITION;
+		bool live = false;
+		for (unsigned s = first; s < last; ++s)
+		{
+			if (!states[s].present)
+				continue;
+			minX = Min(minX, (int)states[s].x);
+			minZ = Min(minZ, (int)states[s].z);
+			maxX = Max(maxX, (int)states[s].x);
+			maxZ = Max(maxZ, (int)states[s].z);
+			live = true;
+		}
+
+		chunkLive[g] = live;
+		if (!live)
+			continue;
+		chunkCentre[g] = Vector3((minX + maxX) * 0.5f, 0.0f, (minZ + maxZ) * 0.5f) / POSITION_SCALE;
+		chunkRadius[g] = Vector2((float)(maxX - minX), (float)(maxZ - minZ)).Length() * 0.5f / POSITION_SCALE;
+	}
+}
+
+void FlockSnapshotSender::AssignSlots(FlockState& state, const BoidSet& set, unsigned captured)
+{
+	const Flock& flock = set.flock;
+
+	// A boid shot or despawned since the last capture frees its slot, and a pool slot reused since then counts as gone
+	for (unsigned i = 0; i < flock.GetNumBoids(); ++i)
+	{
+		if (!flock.alive[i])
+			continue;
+		BoidHandle handle = set.GetHandle(i);
+		state.seen[handle.slot] = captured;
+		if (state.generation[handle.slot] != handle.generation && state.slotOfPool[handle.slot] != M_MAX_UNSIGNED)
+		{
+			state.poolOfSlot[state.slotOfPool[handle.slot]] = M_MAX_UNSIGNED;
+			state.slotOfPool[handle.slot] = M_MAX_UNSIGNED;
+		}
+		state.generation[handle.slot] = handle.generation;
+	}
+	for (unsigned p = 0; p < state.capacity; ++p)
+	{
+		if (state.seen[p] != captured && state.slotOfPool[p] != M_MAX_UNSIGNED)
+		{
+			state.poolOfSlot[state.slotOfPool[p]] = M_MAX_UNSIGNED;
+			state.slotOfPool[p] = M_MAX_UNSIGNED;
+		}
+	}
+
+	if (IsSortSequence(captured))
+		SortSlots(state, set);
+
+	// Boids spawned since the last sort take any free slot until the next one places them
+	unsigned freeSlot = 0;
+	for (unsigned i = 0; i < flock.GetNumBoids(); ++i)
+	{
+		if (!flock.alive[i])
+			continue;
+		BoidHandle handle = set.GetHandle(i);
+		if (state.slotOfPool[handle.slot] != M_MAX_UNSIGNED)
+			continue;
+		while (state.poolOfSlot[freeSlot] != M_MAX_UNSIGNED)
+			++freeSlot;
+		TakeSlot(state, freeSlot, handle.slot);
+	}
+}
+
+void FlockSnapshotSender::SortSlots(FlockState& state, const BoidSet& set)
+{
+	const Flock& flock = set.flock;
+	sortKeys.Clear();
+	for (unsigned i = 0; i < flock.GetNumBoids(); ++i)
+	{
+		if (flock.alive[i])
+			sortKeys.Push((unsigned long long)CurveKey(flock.position[i]) << 32 | set.GetHandle(i).slot);
+	}
+	Sort(sortKeys.Begin(), sortKeys.End());
+
+	// The nth boid along the curve belongs in chunk n / CHUNK_SLOTS. Those already there keep their slot
+	for (unsigned n = 0; n < sortKeys.Size(); ++n)
+	{
+		unsigned pool = (unsigned)sortKeys[n];
+		unsigned slot = state.slotOfPool[pool];
+		if (slot != M_MAX_UNSIGNED && slot / CHUNK_SLOTS != n / CHUNK_SLOTS)
+		{
+			state.poolOfSlot[slot] = M_MAX_UNSIGNED;
+			state.slotOfPool[pool] = M_MAX_UNSIGNED;
+		}
+	}
+
+	// The rest fill the free slots of their chunk, no more boids are sorted into a chunk than it has slots
+	unsigned freeSlot = 0;
+	for (unsigned n = 0; n < sortKeys.Size(); ++n)
+	{
+		unsigned pool = (unsigned)sortKeys[n];
+		if (n % CHUNK_SLOTS == 0)
+			freeSlot = n;
+		if (state.slotOfPool[pool] != M_MAX_UNSIGNED)
+			continue;
+		while (state.poolOfSlot[freeSlot] != M_MAX_UNSIGNED)
+			++freeSlot;
+		TakeSlot(state, freeSlot, pool);
+	}
+}
+
+void FlockSnapshotSender::TakeSlot(FlockState& state, unsigned slot, unsigned pool)
+{
+	state.slotOfPool[pool] = slot;
+	state.poolOfSlot[slot] = pool;
+	state.occupant[slot] = (unsigned char)((state.occupant[slot] + 1) & ((1 << OCCUPANT_BITS) - 1));
+}
+
+void FlockSnapshotSender::FindBands(const Vector3& position)
+{
+	for (unsigned g = 0; g < numChunks; ++g)
+		chunkBand[g] = BAND_NONE;
+
+	if (interest.cutoff == M_INFINITY)
+	{
+		for (unsigned g = 0; g < numChunks; ++g)
+			chunkBand[g] = chunkLive[g] ? BAND_NEAR : BAND_NONE;
+		return;
+	}
+
+	// Distance to the nearest edge of a chunk's bound, so a spread out chunk is sent to anyone near any of it
+	chunkGrid.ForEachCandidate(position, interest.cutoff + maxChunkRadius, [&](unsigned g) {
+		Vector2 offset(chunkCentre[g].x_ - position.x_, chunkCentre[g].z_ - position.z_);
+		float distance = Max(offset.Length() - chunkRadius[g], 0.0f);
+		if (distance <= interest.nearDistance)
+			chunkBand[g] = BAND_NEAR;
+		else if (distance <= interest.cutoff)
+			chunkBand[g] = BAND_FAR;
+	});
+}
+
+const BoidSnapshot* FlockSnapshotSender::GetHistory(const FlockState& state, unsigned captured) const
+{
+	if (!captured || sequence - captured >= SNAPSHOT_HISTORY)
+		return nullptr;
+	unsigned block = captured % SNAPSHOT_HISTORY;
+	if (state.historySequence[block] != captured)
+		return nullptr;
+	return &state.history[block * state.capacity];
+}
+
+FlockSnapshotReceiver::FlockView::FlockView() :
+	numSlots(0)
+{
+}
+
+FlockSnapshotReceiver::FlockSnapshotReceiver() :
+	clock(0.0f),
+	serverOffset(0.0f),
+	synced(false),
+	delay(0.15f),
+	maxExtrapolation(0.1f)
+{
+}
+
+void FlockSnapshotReceiver::Clear()
+{
+	flocks.Clear();
+	acks.Clear();
+	clock = 0.0f;
+	serverOffset = 0.0f;
+	synced = false;
+}
+
+void FlockSnapshotReceiver::HandleSnapshot(MemoryBuffer& snapshot)
+{
+	unsigned nodeID = snapshot.ReadUInt();
+	unsigned chunk = snapshot.ReadVLE();
+	unsigned sequence = snapshot.ReadUInt();
+	float time = snapshot.ReadFloat();
+	unsigned baseline = snapshot.ReadUInt();
+	unsigned elapsedMs = snapshot.ReadVLE();
+	unsigned count = snapshot.ReadVLE();
+	if (!sequence || count > CHUNK_SLOTS || snapshot.IsEof())
+		return;
+
+	FlockView& view = flocks[nodeID];
+	Resize(view, chunk * CHUNK_SLOTS + count);
+	unsigned numChunks = view.numSlots / CHUNK_SLOTS;
+
+	// A newer sequence has already taken this history block, or this one arrived twice
+	unsigned block = sequence % SNAPSHOT_HISTORY;
+	unsigned& received = view.chunkSequence[block * numChunks + chunk];
+	if (received >= sequence)
+		return;
+
+	const BoidSnapshot* base = nullptr;
+	if (baseline)
+	{
+		unsigned baseBlock = baseline % SNAPSHOT_HISTORY;
+		if (baseBlock == block || view.chunkSequence[baseBlock * numChunks + chunk] != baseline)
+			return;
+		base = &view.history[baseBlock * view.numSlots + chunk * CHUNK_SLOTS];
+	}
+
+	BoidSnapshot* states = &view.history[block * view.numSlots + chunk * CHUNK_SLOTS];
+	BitReader reader(snapshot.GetData() + snapshot.GetPosition(), snapshot.GetSize() - snapshot.GetPosition());
+	for (unsigned i = 0; i < count; ++i)
+		DecodeBoid(reader, base ? base[i] : ABSENT, elapsedMs, states[i]);
+	for (unsigned i = count; i < CHUNK_SLOTS; ++i)
+		states[i] = ABSENT;
+
+	// A short message leaves the block half written, so it cannot be a baseline
+	if (reader.IsOverrun())
+	{
+		received = 0;
+		return;
+	}
+
+	received = sequence;
+	view.chunkTime[block * numChunks + chunk] = time;
+
+	// The least delayed snapshots give the best estimate of the server clock
+	float offset = time - clock;
+	if (!synced || offset > serverOffset)
+		serverOffset = offset;
+	else
+		serverOffset += (offset - serverOffset) * CLOCK_SETTLE;
+	synced = true;
+
+	Ack ack;
+	ack.nodeID = nodeID;
+	ack.chunk = chunk;
+	ack.sequence = sequence;
+	acks.Push(ack);
+}
+
+void FlockSnapshotReceiver::HandleDrop(MemoryBuffer& drop)
+{
+	unsigned nodeID = drop.ReadUInt();
+	unsigned chunk = drop.ReadVLE();
+	unsigned sequence = drop.ReadUInt();
+	if (!sequence)
+		return;
+
+	HashMap<unsigned, FlockView>::Iterator i = flocks.Find(nodeID);
+	if (i == flocks.End() || chunk >= i->second_.dropped.Size())
+		return;
+
+	// Snapshots sent before the drop may still arrive, they stay hidden
+	FlockView& view = i->second_;
+	view.dropped[chunk] = Max(view.dropped[chunk], sequence);
+}
+
+void FlockSnapshotReceiver::UpdateRenderers(Scene* scene, float timeStep)
+{
+	clock += timeStep;
+	float shown = clock + serverOffset - delay;
+
+	for (HashMap<unsigned, FlockView>::Iterator i = flocks.Begin(); i != flocks.End(); ++i)
+	{
+		Node* node = scene->GetNode(i->first_);
+		FlockRenderer* renderer = node ? node->GetComponent<FlockRenderer>() : nullptr;
+		if (!renderer)
+			continue;
+
+		positions.Clear();
+		rotations.Clear();
+		for (unsigned k = 0; k < i->second_.dropped.Size(); ++k)
+			DrawChunk(i->second_, k, shown);
+		renderer->SetInstances(positions.Buffer(), rotations.Buffer(), positions.Size());
+	}
+}
+
+void FlockSnapshotReceiver::DrawChunk(const FlockView& view, unsigned chunk, float shown)
+{
+	// The received states either side of the shown time, newer than the last drop
+	unsigned numChunks = view.numSlots / CHUNK_SLOTS;
+	int from = -1;
+	int to = -1;
+	for (unsigned h = 0; h < SNAPSHOT_HISTORY; ++h)
+	{
+		unsigned sequence = view.chunkSequence[h * numChunks + chunk];
+		if (!sequence || sequence <= view.dropped[chunk])
+			continue;
+		float time = view.chunkTime[h * numChunks + chunk];
+		if (time <= shown)
+		{
+			if (from < 0 || time > view.chunkTime[from * numChunks + chunk])
+				from = h;
+		}
+		else if (to < 0 || time < view.chunkTime[to * numChunks + chunk])
+			to = h;
+	}
+	if (from < 0 && to < 0)
+		return;
+
+	// Before the oldest state there is nothing to move from, and after the newest boids fly on a while
+	float t = 0.0f;
+	float lead = 0.0f;
+	float fromLead = 0.0f;
+	if (from < 0)
+		from = to;
+	else if (to < 0)
+	{
+		lead = Min(shown - view.chunkTime[from * numChunks + chunk], maxExtrapolation);
+		to = from;
+	}
+	else
+	{
+		float fromTime = view.chunkTime[from * numChunks + chunk];
+		t = (shown - fromTime) / (view.chunkTime[to * numChunks + chunk] - fromTime);
+		fromLead = Min(shown - fromTime, maxExtrapolation);
+	}
+
+	const BoidSnapshot* a = &view.history[from * view.numSlots + chunk * CHUNK_SLOTS];
+	const BoidSnapshot* b = &view.history[to * view.numSlots + chunk * CHUNK_SLOTS];
+	for (unsigned s = 0; s < CHUNK_SLOTS; ++s)
+	{
+		// A boid is drawn until the state it died in, and from the state it spawned in
+		if (!a[s].present)
+			continue;
+
+		float x = a[s].x;
+		float z = a[s].z;
+		float heading = a[s].heading;
+		float slotLead = lead;
+		if (b[s].present && b[s].occupant == a[s].occupant)
+		{
+			x = Lerp(x, (float)b[s].x, t);
+			z = Lerp(z, (float)b[s].z, t);
+			heading += HeadingTurn(a[s].heading, b[s].heading) * t;
+		}
+		// Gone by the next state, or the slot went to another boid. Blending into that would slide one
+		// boid onto another, so this one flies straight on until the next state replaces it
+		else
+			slotLead = fromLead;
+
+		float angle = heading * (360.0f / HEADING_STEPS);
+		Vector3 direction(Sin(angle), 0.0f, Cos(angle));
+		Vector3 position(x / POSITION_SCALE, SNAPSHOT_HEIGHT, z / POSITION_SCALE);
+		positions.Push(position + direction * (a[s].speed / POSITION_SCALE * slotLead));
+		rotations.Push(Flock::GetHeading(direction));
+	}
+}
+
+void FlockSnapshotReceiver::SendAcks(Connection* server)
+{
+	for (unsigned first = 0; first < acks.Size(); first += ACKS_PER_MESSAGE)
+	{
+		unsigned count = Min(ACKS_PER_MESSAGE, acks.Size() - first);
+		message.Clear();
+		message.WriteVLE(count);
+		for (unsigned a = first; a < first + count; ++a)
+		{
+			message.WriteUInt(acks[a].nodeID);
+			message.WriteVLE(acks[a].chunk);
+			message.WriteUInt(acks[a].sequence);
+		}
+		SendNetMessage(server, MSG_FLOCK_ACK, message);
+	}
+	acks.Clear();
+}
+
+void FlockSnapshotReceiver::Resize(FlockView& view, unsigned numSlots)
+{
+	numSlots = (numSlots + CHUNK_SLOTS - 1) / CHUNK_SLOTS * CHUNK_SLOTS;
+	if (numSlots <= view.numSlots)
+		return;
+
+	unsigned oldChunks = view.numSlots / CHUNK_SLOTS;
+	unsigned numChunks = numSlots / CHUNK_SLOTS;
+	PODVector<BoidSnapshot> history(SNAPSHOT_HISTORY * numSlots);
+	PODVector<unsigned> chunkSequence(SNAPSHOT_HISTORY * numChunks);
+	PODVector<float> chunkTime(SNAPSHOT_HISTORY * numChunks);
+	for (unsigned h = 0; h < SNAPSHOT_HISTORY; ++h)
+	{
+		for (unsigned s = 0; s < numSlots; ++s)
+			history[h * numSlots + s] = s < view.numSlots ? view.history[h * view.numSlots + s] : ABSENT;
+		for (unsigned k = 0; k < numChunks; ++k)
+		{
+			chunkSequence[h * numChunks + k] = k < oldChunks ? view.chunkSequence[h * oldChunks + k] : 0;
+			chunkTime[h * numChunks + k] = k < oldChunks ? view.chunkTime[h * oldChunks + k] : 0.0f;
+		}
+	}
+	view.history.Swap(history);
+	view.chunkSequence.Swap(chunkSequence);
+	view.chunkTime.Swap(chunkTime);
+	view.dropped.Resize(numChunks);
+	for (unsigned k = oldChunks; k < numChunks; ++k)
+		view.dropped[k] = 0;
+	view.numSlots = numSlots;
+}
@@ -0,0 +1,225 @@
+#pragma once
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+
+#include "BoidGrid.h"
+#include "BoidSet.h"
+#include "Interest.h"
+#include "NetMessages.h"
+
+namespace Urho3D
+{
+	class Connection;
+	class Scene;
+}
+
+using namespace Urho3D;
+
+/// A boid as clients see it: quantised ground position and motion. Height is fixed.
+struct BoidSnapshot
+{
+	/// Position in quarter units.
+	short x;
+	short z;
+	/// Direction of travel in 1/64 turns.
+	unsigned char heading;
+	/// Speed in quarter units per second.
+	unsigned char speed;
+	/// Count of the boids the slot has held, wrapping. A state with another count is another boid.
+	unsigned char occupant;
+	/// Whether the slot holds a live boid.
+	bool present;
+};
+
+/// Server side of the flock channel, which replaces per-node replication of the boids.
+/// Each send quantises every flock once by snapshot slot, then sends each client one unreliable message per chunk
+/// of slots, bit packed and delta encoded against the newest state of that chunk the client acknowledged.
+/// Snapshot slots are handed out by where boids are, so each chunk holds one patch of the flock. Every so
+/// often the live boids are sorted along a space filling curve and cut into chunks, and only boids whose
+/// chunk changed move slot. A boid keeps its slot between sorts, so its deltas stay small. A slot given to
+/// another boid is sent in full with its new occupant count, and far chunks go out on every sort send, so a
+/// boid that changed chunk leaves the old one and turns up in the new one in the same sequence.
+/// Heading and speed go first as the turn and change since the baseline, then the position as the error of
+/// moving the baseline on along the mean of the old and new motion, which is usually zero or a quantum.
+/// Chunks with no valid baseline go in full, chunks unchanged since their baseline are skipped, and a lost
+/// message is covered by the next send.
+/// Chunks are binned on a grid by where their boids are, and each client is only sent the chunks within
+/// its interest range of its connection position. A chunk that leaves the range is dropped by a reliable
+/// MSG_FLOCK_DROP, so the client stops drawing it.
+class FlockSnapshotSender
+{
+public:
+	FlockSnapshotSender();
+
+	/// Replicate the given flocks, which must keep their pool capacity. Forgets every client.
+	void Initialise(const Vector<SharedPtr<BoidSet> >& sets);
+	void Clear();
+	/// Set what each client is sent by distance. The default sends every chunk at the full rate.
+	void SetInterest(const InterestRange& range);
+
+	/// Quantise every flock into a new sequence at time and send it to each connection with a loaded scene.
+	void Send(const Vector<SharedPtr<Connection> >& connections, float time);
+	/// Read a MSG_FLOCK_ACK from a client.
+	void HandleAck(Connection* connection, MemoryBuffer& message);
+	/// Forget a client that has disconnected, so a new connection at its address starts from nothing.
+	void RemoveClient(Connection* connection) { clients.Erase(connection); }
+	/// Quantise every flock into a new sequence at time and return the bytes a client at position would be
+	/// sent, without sending them. The client acknowledges every send at once. For benchmarking the encoding,
+	/// do not mix with Send.
+	unsigned MeasureSend(const Vector3& position, float time);
+
+	/// Snapshot bytes sent since Initialise, headers included.
+	unsigned long long GetBytesSent() const { return bytesSent; }
+
+private:
+	struct FlockState
+	{
+		WeakPtr<Node> node;
+		unsigned capacity;
+		unsigned numChunks;
+		/// Start of this flock's chunks in a client's acknowledgements.
+		unsigned firstChunk;
+		/// Quantised flock of the last SNAPSHOT_HISTORY sends, a block of capacity each.
+		PODVector<BoidSnapshot> history;
+		/// Sequence each block of history was written by.
+		PODVector<unsigned> historySequence;
+		/// Snapshot slot of each pool slot, M_MAX_UNSIGNED if it holds no live boid.
+		PODVector<unsigned> slotOfPool;
+		/// Pool slot in each snapshot slot, M_MAX_UNSIGNED if the slot is free.
+		PODVector<unsigned> poolOfSlot;
+		/// Generation of the boid each pool slot's snapshot slot was given to, a respawned boid gets a new one.
+		PODVector<unsigned> generation;
+		/// Last sequence each pool slot held a live boid in.
+		PODVector<unsigned> seen;
+		/// Occupant count of each snapshot slot.
+		PODVector<unsigned char> occupant;
+	};
+
+	/// What a client has of every chunk of every flock.
+	struct ClientView
+	{
+		/// Newest acknowledged sequence, 0 for none.
+		PODVector<unsigned> acked;
+		/// Whether the client may be drawing the chunk, so leaving its range needs a drop.
+		PODVector<bool> inView;
+	};
+
+	/// How often a client is sent a chunk.
+	enum ChunkBand
+	{
+		BAND_NONE,
+		BAND_FAR,
+		BAND_NEAR
+	};
+
+	/// Quantise every flock into a new sequence at time. Return false if there are none.
+	bool TakeSnapshot(float time);
+	/// Send a client at position what it lacks of the current sequence, or only encode it if connection
+	/// is null. Return the bytes sent.
+	unsigned SendTo(Connection* connection, ClientView& view, const Vector3& position, float time);
+	/// Quantise a flock into its history block for sequence, and bound each of its chunks.
+	void Capture(FlockState& state, const BoidSet& set, unsigned sequence);
+	/// Give every live boid of a flock a snapshot slot and free those of boids that are gone.
+	void AssignSlots(FlockState& state, const BoidSet& set, unsigned captured);
+	/// Put a boid in a free snapshot slot, as a new occupant.
+	void TakeSlot(FlockState& state, unsigned slot, unsigned pool);
+	/// Move boids between chunks so each chunk holds the boids of one stretch of the curve.
+	void SortSlots(FlockState& state, const BoidSet& set);
+	/// Sort every chunk into the band it falls in for a client at position.
+	void FindBands(const Vector3& position);
+	/// Return the history block of a flock for sequence, or null if it has been overwritten.
+	const BoidSnapshot* GetHistory(const FlockState& state, unsigned sequence) const;
+
+	const Vector<SharedPtr<BoidSet> >* sets;
+	Vector<FlockState> flocks;
+	HashMap<Connection*, ClientView> clients;
+	/// The client of MeasureSend.
+	ClientView measureView;
+	/// Time of each of the last SNAPSHOT_HISTORY sends, by sequence.
+	PODVector<float> sendTime;
+	unsigned numChunks;
+	InterestRange interest;
+	/// Centre and radius on the ground of the live boids of every chunk as of the last capture.
+	PODVector<Vector3> chunkCentre;
+	PODVector<float> chunkRadius;
+	/// Whether each chunk has any live boids, the others are not binned.
+	PODVector<bool> chunkLive;
+	float maxChunkRadius;
+	/// Chunk centres, so a client's range only visits the chunks near it.
+	BoidGrid chunkGrid;
+	/// Band of every chunk for the client being sent to.
+	PODVector<unsigned char> chunkBand;
+	unsigned sequence;
+	unsigned long long bytesSent;
+	VectorBuffer message;
+	PODVector<unsigned char> bits;
+	/// Curve position and pool slot of each live boid, for SortSlots.
+	PODVector<unsigned long long> sortKeys;
+};
+
+/// Client side of the flock channel. Decodes each chunk into a history of its own, so later deltas find
+/// their baseline, and acknowledges what it decoded in batches. The flocks are drawn with their nodes'
+/// FlockRenderer a delay behind the server, interpolated between the received states either side, so
+/// the send rate only limits how closely they follow the server and not how smoothly they move.
+class FlockSnapshotReceiver
+{
+public:
+	FlockSnapshotReceiver();
+
+	void Clear();
+	/// Set how far behind the newest snapshot the flocks are drawn. Should cover a send interval plus jitter.
+	void SetDelay(float delay) { this->delay = Max(delay, 0.0f); }
+	/// Set how long boids fly on along their last heading when snapshots stop.
+	void SetMaxExtrapolation(float time) { maxExtrapolation = Max(time, 0.0f); }
+	/// Decode a MSG_FLOCK_SNAPSHOT. Chunks whose baseline is gone or which arrive twice are dropped.
+	void HandleSnapshot(MemoryBuffer& message);
+	/// Read a MSG_FLOCK_DROP, hiding a chunk until a newer snapshot of it arrives.
+	void HandleDrop(MemoryBuffer& message);
+	/// Advance the clock by timeStep and redraw every flock as of the delayed server time.
+	void UpdateRenderers(Scene* scene, float timeStep);
+	/// Server time the flocks were last drawn at, negative until a snapshot has arrived.
+	float GetShownTime() const { return synced ? clock + serverOffset - delay : -1.0f; }
+	/// Acknowledge the chunks decoded since the last call.
+	void SendAcks(Connection* server);
+
+private:
+	struct FlockView
+	{
+		FlockView();
+
+		unsigned numSlots;
+		/// Received states of the last SNAPSHOT_HISTORY sequences, a block of numSlots each.
+		PODVector<BoidSnapshot> history;
+		/// Sequence of every chunk in every history block, 0 if not received.
+		PODVector<unsigned> chunkSequence;
+		/// Server time every chunk in every history block was sent at.
+		PODVector<float> chunkTime;
+		/// Sequence each chunk was last dropped at, only newer states of it are drawn.
+		PODVector<unsigned> dropped;
+	};
+
+	struct Ack
+	{
+		unsigned nodeID;
+		unsigned chunk;
+		unsigned sequence;
+	};
+
+	/// Grow a flock's history to hold numSlots slots.
+	void Resize(FlockView& view, unsigned numSlots);
+	/// Append the boids of one chunk as of time shown.
+	void DrawChunk(const FlockView& view, unsigned chunk, float shown);
+
+	HashMap<unsigned, FlockView> flocks;
+	PODVector<Ack> acks;
+	/// Time since Clear, and the server time less it as measured by the least delayed snapshots.
+	float clock;
+	float serverOffset;
+	bool synced;
+	float delay;
+	float maxExtrapolation;
+	VectorBuffer message;
+	PODVector<Vector3> positions;
+	PODVector<Quaternion> rotations;
+};
@@ -0,0 +1,133 @@
+#include <Urho3D/Core/WorkQueue.h>
+
+#include "FlockWorld.h"
+
+FlockWorld::FlockWorld()
+{
+	useGrid = true;
+	for (unsigned s = 0; s < MAX_FLOCK_SPECIES; s++)
+	{
+		for (unsigned o = 0; o < MAX_FLOCK_SPECIES; o++)
+		{
+			float weight = s == o ? 1.0f : 0.0f;
+			interactions[s][o].schooling = weight;
+			interactions[s][o].avoidance = weight;
+		}
+	}
+}
+
+void FlockWorld::AddFlock(Flock* flock)
+{
+	if (flock && !flocks.Contains(flock))
+		flocks.Push(flock);
+}
+
+void FlockWorld::RemoveFlock(Flock* flock)
+{
+	if (flocks.Remove(flock))
+		flock->index = &flock->ownIndex;
+}
+
+void FlockWorld::Clear()
+{
+	for (unsigned i = 0; i < flocks.Size(); i++)
+		flocks[i]->index = &flocks[i]->ownIndex;
+	flocks.Clear();
+}
+
+void FlockWorld::SetInteraction(unsigned species, unsigned other, float schooling, float avoidance)
+{
+	if (species >= MAX_FLOCK_SPECIES || other >= MAX_FLOCK_SPECIES)
+		return;
+	interactions[species][other].schooling = schooling;
+	interactions[species][other].avoidance = avoidance;
+}
+
+void FlockWorld::ComputeForces(WorkQueue* queue)
+{
+	if (flocks.Empty())
+		return;
+
+	for (unsigned i = 0; i < flocks.Size(); i++)
+	{
+		Flock* flock = flocks[i];
+		flock->UpdateTotals();
+		flock->SetInteractions(interactions[Min(flock->species, MAX_FLOCK_SPECIES - 1)]);
+	}
+
+	index.Build(&flocks[0], flocks.Size(), useGrid);
+
+	// Queue every flock before waiting, so small flocks share the worker threads
+	bool queued = false;
+	for (unsigned i = 0; i < flocks.Size(); i++)
+	{
+		flocks[i]->index = &index;
+		if (flocks[i]->QueueForces(queue))
+			queued = true;
+	}
+
+	if (queued)
+		queue->Complete(M_MAX_UNSIGNED);
+}
+
+bool FlockWorld::SweepSphere(const Vector3& start, const Vector3& end, float radius, float timeStep, FlockHit& hit) const
+{
+	hit.flock = nullptr;
+	hit.boid = M_MAX_UNSIGNED;
+	hit.fraction = M_INFINITY;
+
+	Vector3 centre = (start + end) * 0.5f;
+	float reach = (end - start).Length() * 0.5f + radius;
+
+	ForEachCandidate(centre, reach, [&](Flock* flock, unsigned i) {
+		if (!flock->alive[i])
+			return;
+
+		// Sweep in the boid's frame: from where it started the step, the sphere moves by its own step less the boid's
+		Vector3 boidMove = flock->velocity[i] * timeStep;
+		float t;
+		if (SweepTest(start - (flock->position[i] - boidMove), (end - start) - boidMove, radius, t) && t < hit.fraction)
+		{
+			hit.flock = flock;
+			hit.boid = i;
+			hit.fraction = t;
+		}
+	});
+	return hit.flock != nullptr;
+}
+
+bool FlockWorld::SweepTest(const Vector3& from, const Vector3& move, float radius, float& fraction)
+{
+	float radius2 = radius * radius;
+	float a = move.LengthSquared();
+	float t = a > M_EPSILON ? Clamp(-from.DotProduct(move) / a, 0.0f, 1.0f) : 0.0f;
+	if ((from + move * t).LengthSquared() > radius2)
+		return false;
+
+	// Back up from the closest approach to where the sphere first touches
+	if (a > M_EPSILON)
+	{
+		float b = from.DotProduct(move);
+		float c = from.LengthSquared() - radius2;
+		float disc = b * b - a * c;
+		t = c <= 0.0f ? 0.0f : Max((-b - Sqrt(Max(disc, 0.0f))) / a, 0.0f);
+	}
+	fraction = t;
+	return true;
+}
+
+unsigned FlockWorld::GetStateHash() const
+{
+	unsigned hash = FLOCK_HASH_BASIS;
+	for (unsigned f = 0; f < flocks.Size(); ++f)
+		hash = flocks[f]->GetStateHash(hash);
+	return hash;
+}
+
+float FlockWorld::GetDrift() const
+{
+	float drift = 0.0f;
+	for (unsigned i = 0; i < flocks.Size(); i++)
+		drift = Max(drift, flocks[i]->gridDrift);
+	return drift;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "Flock.h"
+#include "FlockIndex.h"
+
+/// First boid a swept sphere touches.
+struct FlockHit
+{
+	Flock* flock;
+	unsigned boid;
+	/// How far along the sweep the hit is, 0 at the start and 1 at the end.
+	float fraction;
+};
+
+/// Steps several flocks against one shared neighbour index, so boids react to other flocks' boids too.
+/// How strongly comes from a species by species interaction table, then each flock's neighbourMask.
+/// The world does not own its flocks. A flock must stay alive while it is added, and must not be
+/// resized between ComputeForces and the queries that use its index.
+class FlockWorld
+{
+public:
+	FlockWorld();
+
+	void AddFlock(Flock* flock);
+	void RemoveFlock(Flock* flock);
+	/// Remove every flock. Flocks go back to their own index.
+	void Clear();
+	unsigned GetNumFlocks() const { return flocks.Size(); }
+
+	/// Set how boids of one species react to boids of another. Within a species the default is
+	/// full schooling and avoidance, between species no reaction at all.
+	void SetInteraction(unsigned species, unsigned other, float schooling, float avoidance);
+	const FlockInteraction& GetInteraction(unsigned species, unsigned other) const { return interactions[species][other]; }
+
+	/// Index every flock's live boids once, then fill each flock's force[] against all of them.
+	/// Like Flock::ComputeForces the forces only depend on the packed snapshot, the caller integrates afterwards.
+	void ComputeForces(WorkQueue* queue = nullptr);
+
+	/// Find the first live boid a sphere of radius touches moving from start to end over the last timeStep.
+	/// Boids are taken back along their velocity, so the test is against their motion over the same step.
+	/// Uses the index from the last ComputeForces, widened by how far boids have moved since.
+	bool SweepSphere(const Vector3& start, const Vector3& end, float radius, float timeStep, FlockHit& hit) const;
+
+	/// Sweep a sphere of radius that starts at from, relative to a point, and moves by move.
+	/// Return whether it touches the point, and how far along the move it first does.
+	static bool SweepTest(const Vector3& from, const Vector3& move, float radius, float& fraction);
+
+	/// Hash of every flock's state, in the order they were added. See Flock::GetStateHash.
+	unsigned GetStateHash() const;
+
+	/// Call func(flock, index) for each boid that may be within radius of centre, alive or not.
+	/// Uses the index from the last ComputeForces, widened by how far boids have moved since.
+	template <class F> void ForEachCandidate(const Vector3& centre, float radius, F func) const
+	{
+		if (flocks.Empty())
+			return;
+
+		index.ForEachCandidate(centre, radius + GetDrift(), [&](unsigned id) {
+			// Ids are handed out in flock order
+			unsigned f = flocks.Size();
+			while (f-- > 0 && flocks[f]->indexBase > id);
+			unsigned i = id - flocks[f]->indexBase;
+			if (i < flocks[f]->GetNumBoids())
+				func(flocks[f], i);
+		});
+	}
+
+	/// Bin boids into a uniform grid instead of testing every pair.
+	bool useGrid;
+
+private:
+	/// Furthest any boid has moved since the index was built.
+	float GetDrift() const;
+
+	PODVector<Flock*> flocks;
+	FlockInteraction interactions[MAX_FLOCK_SPECIES][MAX_FLOCK_SPECIES];
+	FlockIndex index;
+};
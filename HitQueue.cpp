@@ -0,0 +1,39 @@
+#include <Urho3D/Math/MathDefs.h>
+
+#include "HitQueue.h"
+
+HitQueue::HitQueue() :
+	count(0)
+{
+}
+
+void HitQueue::SetCapacity(unsigned capacity)
+{
+	hits.Resize(capacity);
+	Clear();
+}
+
+bool HitQueue::Push(const BoidHit& hit)
+{
+	unsigned index = count.fetch_add(1, std::memory_order_relaxed);
+	if (index >= hits.Size())
+		return false;
+	hits[index] = hit;
+	return true;
+}
+
+void HitQueue::Clear()
+{
+	count.store(0, std::memory_order_relaxed);
+}
+
+unsigned HitQueue::GetNumHits() const
+{
+	return Min(count.load(std::memory_order_relaxed), hits.Size());
+}
+
+unsigned HitQueue::GetNumDropped() const
+{
+	unsigned pushed = count.load(std::memory_order_relaxed);
+	return pushed > hits.Size() ? pushed - hits.Size() : 0;
+}
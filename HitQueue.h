@@ -0,0 +1,45 @@
+#pragma once
+#include <Urho3D/Container/Vector.h>
+
+#include <atomic>
+
+using namespace Urho3D;
+
+class Flock;
+
+/// A bullet hitting a boid, recorded during a step and applied after it.
+struct BoidHit
+{
+	/// Pool slot of the bullet.
+	unsigned bullet;
+	/// ID of the node that fired it, credited with the kill.
+	unsigned owner;
+	Flock* flock;
+	unsigned boid;
+};
+
+/// Fixed size queue hits are pushed to while physics and the bullet sweeps run.
+/// Push only bumps an atomic counter and writes its own slot, so producers on any thread never lock.
+/// Reading and Clear must not overlap pushes, the game drains the queue once per step.
+class HitQueue
+{
+public:
+	HitQueue();
+
+	/// Set how many hits a step can hold. Clears the queue.
+	void SetCapacity(unsigned capacity);
+	/// Queue a hit. When the queue is full the hit is dropped and false returned.
+	bool Push(const BoidHit& hit);
+	/// Forget every queued hit.
+	void Clear();
+
+	unsigned GetNumHits() const;
+	const BoidHit& GetHit(unsigned index) const { return hits[index]; }
+	/// Return how many hits did not fit since the last Clear.
+	unsigned GetNumDropped() const;
+
+private:
+	PODVector<BoidHit> hits;
+	/// Pushes since the last Clear, may run past the capacity.
+	std::atomic<unsigned> count;
+};
@@ -0,0 +1,213 @@
+#include <Urho3D/Graphics/Drawable.h>
+#include <Urho3D/Network/Connection.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "Interest.h"
+#include "NetMessages.h"
+
+// A hidden node is shown again this far inside the cutoff
+static const float SHOW_DISTANCE_FACTOR = 0.9f;
+
+// Enable or disable every drawable of a node and its children
+static void SetDrawablesEnabled(Node* node, bool enable)
+{
+	const Vector<SharedPtr<Component> >& components = node->GetComponents();
+	for (unsigned i = 0; i < components.Size(); ++i)
+	{
+		if (components[i]->IsInstanceOf<Drawable>())
+			components[i]->SetEnabled(enable);
+	}
+
+	const Vector<SharedPtr<Node> >& children = node->GetChildren();
+	for (unsigned i = 0; i < children.Size(); ++i)
+		SetDrawablesEnabled(children[i], enable);
+}
+
+NodeInterestSender::NodeInterestSender() :
+	range(INTEREST_UNLIMITED)
+{
+}
+
+void NodeInterestSender::SetInterest(const InterestRange& interest)
+{
+	range = interest;
+	if (range.cutoff != M_INFINITY)
+		grid.SetCellSize(range.cutoff);
+}
+
+void NodeInterestSender::AddNode(Node* node)
+{
+	SetNodeInterest(node, range);
+	if (range.cutoff == M_INFINITY)
+		return;
+
+	TrackedNode tracked;
+	tracked.node = node;
+	tracked.nodeID = node->GetID();
+	indexOfNode[tracked.nodeID] = nodes.Size();
+	nodes.Push(tracked);
+
+	// Clients draw a new node until told otherwise, the next send hides it from those out of range
+	for (HashMap<Connection*, HashSet<unsigned> >::Iterator i = clients.Begin(); i != clients.End(); ++i)
+		i->second_.Insert(tracked.nodeID);
+}
+
+void NodeInterestSender::Clear()
+{
+	range = INTEREST_UNLIMITED;
+	nodes.Clear();
+	indexOfNode.Clear();
+	clients.Clear();
+	forgotten.Clear();
+}
+
+void NodeInterestSender::Send(const Vector<SharedPtr<Connection> >& connections)
+{
+	if (range.cutoff == M_INFINITY)
+		return;
+
+	for (unsigned n = 0; n < nodes.Size();)
+	{
+		if (nodes[n].node)
+		{
+			++n;
+			continue;
+		}
+		forgotten.Push(nodes[n].nodeID);
+		indexOfNode.Erase(nodes[n].nodeID);
+		nodes.EraseSwap(n);
+		if (n < nodes.Size())
+			indexOfNode[nodes[n].nodeID] = n;
+	}
+
+	// Forget clients that have gone
+	for (HashMap<Connection*, HashSet<unsigned> >::Iterator i = clients.Begin(); i != clients.End();)
+	{
+		bool connected = false;
+		for (unsigned c = 0; c < connections.Size() && !connected; ++c)
+			connected = connections[c].Get() == i->first_;
+		if (connected)
+			++i;
+		else
+			i = clients.Erase(i);
+	}
+
+	positions.Resize(nodes.Size());
+	enabled.Resize(nodes.Size());
+	for (unsigned n = 0; n < nodes.Size(); ++n)
+	{
+		enabled[n] = nodes[n].node->IsEnabled();
+		if (enabled[n])
+			positions[n] = nodes[n].node->GetWorldPosition();
+	}
+	grid.Build(positions.Buffer(), enabled.Buffer(), nodes.Size());
+
+	float hideDistance2 = range.cutoff * range.cutoff;
+	float showDistance = range.cutoff * SHOW_DISTANCE_FACTOR;
+	float showDistance2 = showDistance * showDistance;
+	for (unsigned c = 0; c < connections.Size(); ++c)
+	{
+		Connection* connection = connections[c];
+		// Until then the client has no nodes to hide
+		if (!connection->IsSceneLoaded())
+			continue;
+
+		Vector3 position = connection->GetPosition();
+		changes.Clear();
+		HashMap<Connection*, HashSet<unsigned> >::Iterator view = clients.Find(connection);
+		if (view == clients.End())
+		{
+			// A new client draws every node, so hide all but those in range, once
+			HashSet<unsigned>& shown = clients[connection];
+			grid.ForEachCandidate(position, range.cutoff, [&](unsigned n) {
+				if (GetDistanceSquared(n, position) <= hideDistance2)
+					shown.Insert(nodes[n].nodeID);
+			});
+			for (unsigned n = 0; n < nodes.Size(); ++n)
+			{
+				if (!shown.Contains(nodes[n].nodeID))
+					PushChange(nodes[n].nodeID, true);
+			}
+		}
+		else
+		{
+			HashSet<unsigned>& shown = view->second_;
+			for (unsigned f = 0; f < forgotten.Size(); ++f)
+			{
+				if (!shown.Erase(forgotten[f]))
+					PushChange(forgotten[f], false);
+			}
+
+			for (HashSet<unsigned>::Iterator i = shown.Begin(); i != shown.End();)
+			{
+				unsigned n = indexOfNode[*i];
+				if (enabled[n] && GetDistanceSquared(n, position) > hideDistance2)
+				{
+					PushChange(*i, true);
+					i = shown.Erase(i);
+				}
+				else
+					++i;
+			}
+
+			grid.ForEachCandidate(position, showDistance, [&](unsigned n) {
+				if (GetDistanceSquared(n, position) < showDistance2 && !shown.Contains(nodes[n].nodeID))
+				{
+					shown.Insert(nodes[n].nodeID);
+					PushChange(nodes[n].nodeID, false);
+				}
+			});
+		}
+
+		if (changes.Empty())
+			continue;
+		message.Clear();
+		message.WriteVLE(changes.Size());
+		for (unsigned i = 0; i < changes.Size(); ++i)
+		{
+			message.WriteUInt(changes[i].nodeID);
+			message.WriteBool(changes[i].hidden);
+		}
+		SendNetMessage(connection, MSG_NODE_INTEREST, message);
+	}
+
+	forgotten.Clear();
+}
+
+float NodeInterestSender::GetDistanceSquared(unsigned index, const Vector3& position) const
+{
+	float x = positions[index].x_ - position.x_;
+	float z = positions[index].z_ - position.z_;
+	return x * x + z * z;
+}
+
+void NodeInterestSender::PushChange(unsigned nodeID, bool hidden)
+{
+	Change change = { nodeID, hidden };
+	changes.Push(change);
+}
+
+void NodeInterestReceiver::HandleInterest(MemoryBuffer& message)
+{
+	unsigned count = message.ReadVLE();
+	for (unsigned i = 0; i < count && !message.IsEof(); ++i)
+	{
+		unsigned nodeID = message.ReadUInt();
+		pending[nodeID] = message.ReadBool();
+	}
+}
+
+void NodeInterestReceiver::Update(Scene* scene)
+{
+	for (HashMap<unsigned, bool>::Iterator i = pending.Begin(); i != pending.End();)
+	{
+		Node* node = scene->GetNode(i->first_);
+		if (node)
+			SetDrawablesEnabled(node, !i->second_);
+		// A node to hide may just not have arrived yet, one to show that is not there has nothing to show
+		if (node || !i->second_)
+			i = pending.Erase(i);
+		else
+			++i;
+	}
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/HashSet.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Network/NetworkPriority.h>
+#include <Urho3D/Scene/Node.h>
+
+#include "BoidGrid.h"
+
+namespace Urho3D
+{
+	class Connection;
+	class Scene;
+}
+
+using namespace Urho3D;
+
+/// How much of the world a client is sent, by ground distance from its connection position.
+struct InterestRange
+{
+	/// Within this distance everything is sent at the full rate.
+	float nearDistance;
+	/// Beyond this distance nothing is sent.
+	float cutoff;
+	/// Between the two, flock snapshots go out on one send in this many.
+	unsigned farInterval;
+};
+
+/// Everything at the full rate, for when no range is set.
+static const InterestRange INTEREST_UNLIMITED = { M_INFINITY, M_INFINITY, 1 };
+
+/// Fade a replicated node's updates with distance from each client, to none at the cutoff.
+/// The engine's priority falls off linearly, so updates thin out from the client's own position
+/// rather than holding the full rate out to nearDistance like flock snapshots do.
+inline void SetNodeInterest(Node* node, const InterestRange& range)
+{
+	if (range.cutoff == M_INFINITY)
+		return;
+
+	NetworkPriority* priority = node->GetOrCreateComponent<NetworkPriority>(LOCAL);
+	priority->SetBasePriority(100.0f);
+	priority->SetDistanceFactor(100.0f / range.cutoff);
+	priority->SetMinPriority(0.0f);
+	priority->SetAlwaysUpdateOwner(true);
+}
+
+/// Server side of node interest. The engine creates every replicated node on every client, and NetworkPriority
+/// can only stop a node's updates, so a node stopped at the cutoff would stay drawn where it was last sent.
+/// Instead each client is told by a reliable MSG_NODE_INTEREST which nodes have gone out of its range, and
+/// hides them until they are back. A node is hidden beyond the cutoff and shown again a little inside it,
+/// so one moving along the cutoff does not flicker.
+/// Each client keeps the set of nodes it is shown, everything else is hidden from it. A send bins the enabled
+/// nodes on a grid like the flock chunks, and only checks a client's shown nodes and the grid cells around it,
+/// so the cost follows what is near each client rather than every node. Disabled nodes, the pooled bullets not
+/// in flight, draw nothing and keep whatever state they had until they are enabled again.
+class NodeInterestSender
+{
+public:
+	NodeInterestSender();
+
+	/// Set the range for the nodes added from now on. The default never hides anything.
+	void SetInterest(const InterestRange& range);
+	/// Thin out a replicated node's updates with distance and hide it from the clients out of range.
+	/// A destroyed node is forgotten by the next send.
+	void AddNode(Node* node);
+	void Clear();
+	/// Forget a client that has disconnected, so a new connection at its address starts from nothing.
+	void RemoveClient(Connection* connection) { clients.Erase(connection); }
+	/// Send each connection with a loaded scene the nodes that crossed its range since the last send.
+	/// Meant to run at the network update rate, which is as often as the nodes' own positions go out.
+	void Send(const Vector<SharedPtr<Connection> >& connections);
+
+private:
+	struct TrackedNode
+	{
+		WeakPtr<Node> node;
+		/// Kept apart from the node, which may be gone by the time clients are told to forget it.
+		unsigned nodeID;
+	};
+
+	struct Change
+	{
+		unsigned nodeID;
+		bool hidden;
+	};
+
+	/// Ground distance squared from position to a tracked node, as of the last Send.
+	float GetDistanceSquared(unsigned index, const Vector3& position) const;
+	void PushChange(unsigned nodeID, bool hidden);
+
+	InterestRange range;
+	Vector<TrackedNode> nodes;
+	/// Index in nodes of each tracked node ID.
+	HashMap<unsigned, unsigned> indexOfNode;
+	/// The nodes each client is shown, all the others are hidden from it.
+	HashMap<Connection*, HashSet<unsigned> > clients;
+	/// Nodes destroyed since the last send, shown again on every client hiding them.
+	PODVector<unsigned> forgotten;
+	/// Position of each tracked node and whether it is enabled, as of the last Send.
+	PODVector<Vector3> positions;
+	PODVector<bool> enabled;
+	/// Enabled nodes by position, cells the size of the cutoff.
+	BoidGrid grid;
+	PODVector<Change> changes;
+	VectorBuffer message;
+};
+
+/// Client side of node interest, hiding the drawables of the nodes the server says are out of range.
+/// The server never changes whether a drawable is enabled, so doing it here does not fight replication.
+class NodeInterestReceiver
+{
+public:
+	void Clear() { pending.Clear(); }
+	/// Read a MSG_NODE_INTEREST from the server.
+	void HandleInterest(MemoryBuffer& message);
+	/// Hide or show the nodes named since the last update. A node not replicated yet is retried next update.
+	void Update(Scene* scene);
+
+private:
+	/// Whether each named node is to be hidden, until it is.
+	HashMap<unsigned, bool> pending;
+};
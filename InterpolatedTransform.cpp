@@ -0,0 +1,110 @@
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Scene/Scene.h>
+#include <Urho3D/Scene/SceneEvents.h>
+#include <Urho3D/Scene/SmoothedTransform.h>
+
+#include "InterpolatedTransform.h"
+
+// Updates kept, far more than a delay of a few update intervals needs
+static const unsigned MAX_SAMPLES = 16;
+// An update this far from the last one is a teleport, and is jumped to rather than slid to
+static const float SNAP_DISTANCE = 10.0f;
+
+InterpolatedTransform::InterpolatedTransform(Context* context) :
+	Component(context),
+	time_(0.0f),
+	delay_(0.15f),
+	maxExtrapolation_(0.1f)
+{
+}
+
+void InterpolatedTransform::RegisterObject(Context* context)
+{
+	context->RegisterFactory<InterpolatedTransform>();
+
+	URHO3D_ACCESSOR_ATTRIBUTE("Delay", GetDelay, SetDelay, float, 0.15f, AM_DEFAULT);
+	URHO3D_ACCESSOR_ATTRIBUTE("Max Extrapolation", GetMaxExtrapolation, SetMaxExtrapolation, float, 0.1f, AM_DEFAULT);
+}
+
+void InterpolatedTransform::SetDelay(float delay)
+{
+	delay_ = Max(delay, 0.0f);
+}
+
+void InterpolatedTransform::SetMaxExtrapolation(float time)
+{
+	maxExtrapolation_ = Max(time, 0.0f);
+}
+
+void InterpolatedTransform::OnNodeSet(Node* node)
+{
+	// With a SmoothedTransform present, replication writes its targets instead of the node
+	if (node)
+		node->GetOrCreateComponent<SmoothedTransform>(LOCAL);
+}
+
+void InterpolatedTransform::OnSceneSet(Scene* scene)
+{
+	if (scene)
+		SubscribeToEvent(scene, E_SCENEPOSTUPDATE, URHO3D_HANDLER(InterpolatedTransform, HandleScenePostUpdate));
+	else
+		UnsubscribeFromEvent(E_SCENEPOSTUPDATE);
+}
+
+void InterpolatedTransform::HandleScenePostUpdate(StringHash eventType, VariantMap& eventData)
+{
+	using namespace ScenePostUpdate;
+
+	time_ += eventData[P_TIMESTEP].GetFloat();
+
+	SmoothedTransform* target = node_->GetComponent<SmoothedTransform>();
+	if (!target)
+		return;
+
+	// Only changed transforms are replicated, so a new target is a new update
+	const Vector3& position = target->GetTargetPosition();
+	const Quaternion& rotation = target->GetTargetRotation();
+	if (samples_.Empty() || samples_.Back().position != position || samples_.Back().rotation != rotation)
+	{
+		if (!samples_.Empty() && (position - samples_.Back().position).LengthSquared() > SNAP_DISTANCE * SNAP_DISTANCE)
+			samples_.Clear();
+		if (samples_.Size() == MAX_SAMPLES)
+			samples_.Erase(0);
+		// After a pause the last update is already on show, so the move to this one starts now
+		if (!samples_.Empty())
+			samples_.Back().time = Max(samples_.Back().time, time_ - delay_);
+
+		Sample sample;
+		sample.time = time_;
+		sample.position = position;
+		sample.rotation = rotation;
+		samples_.Push(sample);
+	}
+
+	// Keep one update at or before the shown time to interpolate from
+	float shown = time_ - delay_;
+	while (samples_.Size() > 2 && samples_[1].time <= shown)
+		samples_.Erase(0);
+
+	if (samples_.Size() == 1 || shown <= samples_[0].time)
+	{
+		node_->SetTransform(samples_[0].position, samples_[0].rotation);
+		return;
+	}
+
+	const Sample& from = samples_[samples_.Size() > 1 && samples_[1].time <= shown ? 1 : 0];
+	if (&from == &samples_.Back())
+	{
+		// Run dry. Carry on along the last motion, then settle back, since a node that stopped sends nothing more
+		const Sample& before = samples_[samples_.Size() - 2];
+		Vector3 velocity = (from.position - before.position) / Max(from.time - before.time, M_EPSILON);
+		float ahead = shown - from.time;
+		float lead = ahead <= maxExtrapolation_ ? ahead : Max(2.0f * maxExtrapolation_ - ahead, 0.0f);
+		node_->SetTransform(from.position + velocity * lead, from.rotation);
+		return;
+	}
+
+	const Sample& to = *(&from + 1);
+	float t = (shown - from.time) / (to.time - from.time);
+	node_->SetTransform(from.position.Lerp(to.position, t), from.rotation.Slerp(to.rotation, t));
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <Urho3D/Scene/Component.h>
+
+using namespace Urho3D;
+
+/// Client side smoothing of a replicated node. The node's SmoothedTransform receives the transforms replication
+/// sends, each is kept with the time it arrived, and the node is placed where the buffer says it was delay
+/// seconds ago. When updates stop it carries on along its last motion for a short while and then holds.
+/// Create it LOCAL on remote nodes only, a node the client moves itself would be dragged back.
+class InterpolatedTransform : public Component
+{
+	URHO3D_OBJECT(InterpolatedTransform, Component);
+
+public:
+	/// Construct.
+	InterpolatedTransform(Context* context);
+	/// Register object factory and attributes.
+	static void RegisterObject(Context* context);
+
+	/// Set how far behind the newest update the node is shown. Should cover an update interval plus jitter.
+	void SetDelay(float delay);
+	/// Set how long the node carries on along its last motion when the buffer runs dry.
+	void SetMaxExtrapolation(float time);
+	float GetDelay() const { return delay_; }
+	float GetMaxExtrapolation() const { return maxExtrapolation_; }
+
+protected:
+	/// Create the SmoothedTransform that takes the replicated transforms.
+	virtual void OnNodeSet(Node* node);
+	/// Subscribe to the scene's post-update.
+	virtual void OnSceneSet(Scene* scene);
+
+private:
+	struct Sample
+	{
+		float time;
+		Vector3 position;
+		Quaternion rotation;
+	};
+
+	/// Buffer any new update and place the node.
+	void HandleScenePostUpdate(StringHash eventType, VariantMap& eventData);
+
+	/// Received transforms, oldest first.
+	PODVector<Sample> samples_;
+	/// Time since the component was created.
+	float time_;
+	float delay_;
+	float maxExtrapolation_;
+};
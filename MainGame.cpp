@@ -22,7 +22,10 @@
 
 #include <Urho3D/Core/CoreEvents.h>
 #include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
 #include <Urho3D/Engine/Engine.h>
+#include <Urho3D/Engine/EngineEvents.h>
 #include <Urho3D/Graphics/AnimatedModel.h>
 #include <Urho3D/Graphics/AnimationController.h>
 #include <Urho3D/Graphics/Camera.h>
@@ -57,26 +60,57 @@
 #include "MainGame.h"
 #include "Touch.h"
 #include "BoidSet.h"
-#include "Bullet.h"
+#include "BulletSet.h"
+#include "CollisionTags.h"
+#include "FlockRenderer.h"
+#include "InterpolatedTransform.h"
 
 #include <Urho3D/DebugNew.h>
 
-static const StringHash E_CUSTOMEVENT("CustomEvent");
-
-// Custom remote event we use to tell the client which object they controlstatic
-const StringHash E_CLIENTOBJECTAUTHORITY("ClientObjectAuthority");
-// Identifier for the node ID parameter in the event datastatic 
-const StringHash PLAYER_ID("IDENTITY");
-// Custom event on server, client has pressed button that it wants to start game
-static const StringHash E_CLIENTISREADY("ClientReadyToStart");
-
 URHO3D_DEFINE_APPLICATION_MAIN(MainGame)
 
-const int numOfBoidSet = 4;
-BoidSet* boidSet[4];
-Bullet* bullets;
-
-int FrameSkipper = 0;
+// Engine parameters for flock sizing, settable from the command line with -flocks, -boids and -boidcapacity
+static const String EP_FLOCK_COUNT("FlockCount");
+static const String EP_FLOCK_SIZE("FlockSize");
+static const String EP_FLOCK_CAPACITY("FlockCapacity");
+static const String EP_FLOCK_KINEMATIC("FlockKinematic");
+static const String EP_FLOCK_SEED("FlockSeed");
+// Size of the server's bullet pool, settable with -bullets
+static const String EP_BULLET_CAPACITY("BulletCapacity");
+// Whether bullets skip physics and only hit boids through sweeps, cleared with -physicsbullets
+static const String EP_BULLET_KINEMATIC("BulletKinematic");
+// Whether physics bullets use continuous collision, set with -ccd
+static const String EP_BULLET_CCD("BulletCcd");
+// Server physics steps per second, which the flocks also step at, settable with -physicsfps
+static const String EP_PHYSICS_FPS("PhysicsFps");
+// Flock snapshots sent per second, settable with -flocksendrate
+static const String EP_FLOCK_SEND_RATE("FlockSendRate");
+// Distances from a client within which it is sent everything at the full rate and beyond which it is sent
+// nothing, settable with -interestnear and -interestcutoff. A cutoff of 0 sends everything everywhere
+static const String EP_INTEREST_NEAR("InterestNear");
+static const String EP_INTEREST_CUTOFF("InterestCutoff");
+// Flock snapshot sends per update of a chunk between the two distances
+static const unsigned INTEREST_FAR_INTERVAL = 4;
+// Node replication updates per second, settable with -netfps. Clients interpolate, so this can be well below the frame rate
+static const String EP_NETWORK_FPS("NetworkFps");
+// How far behind the server clients show remote players and boids, settable with -interpdelay
+static const String EP_INTERPOLATION_DELAY("InterpolationDelay");
+// How long remote players and boids carry on along their last motion when updates stop
+static const float MAX_EXTRAPOLATION = 0.1f;
+// Bullet sphere plus boid sphere, for swept hits on boids. The same spheres physics bullets collide with
+static const float BULLET_HIT_RADIUS = Bullet::radius + Boid::radius;
+// Server updates kept for rewinding shots
+static const unsigned HISTORY_FRAMES = 64;
+// Furthest back a shot is rewound, clients lagging more aim at boids nearer the present
+static const float MAX_REWIND = 0.3f;
+// Movement time granted per second of server time. Over 1 to cover step times rounded to milliseconds and clock drift
+static const float MOVE_BUDGET_RATE = 1.05f;
+// Movement a client can save up while its input is late, and commands it can have waiting for a step
+static const float MAX_MOVE_BUDGET = 0.25f;
+static const unsigned MAX_QUEUED_COMMANDS = 2 * MAX_INPUT_COMMANDS;
+// Seconds between shots while fire is held, and bullets one client may have in flight
+static const float FIRE_INTERVAL = 0.15f;
+static const unsigned MAX_CLIENT_BULLETS = 8;
 
 // Which port this is running on 
 static const unsigned short SERVER_PORT = 5845;
@@ -87,12 +121,72 @@ MainGame::MainGame(Context* context) :
 {
 	//TUTORIAL: TODO
 	Character::RegisterObject(context);
+	FlockRenderer::RegisterObject(context);
+	InterpolatedTransform::RegisterObject(context);
 }
 
 MainGame::~MainGame()
 {
 }
 
+void MainGame::Setup()
+{
+	Sample::Setup();
+
+	engineParameters_[EP_FLOCK_COUNT] = 4;
+	engineParameters_[EP_FLOCK_SIZE] = 25;
+	engineParameters_[EP_FLOCK_CAPACITY] = 25;
+	engineParameters_[EP_FLOCK_KINEMATIC] = true;
+	engineParameters_[EP_FLOCK_SEED] = 0;
+	engineParameters_[EP_BULLET_CAPACITY] = 1024;
+	engineParameters_[EP_BULLET_KINEMATIC] = true;
+	engineParameters_[EP_BULLET_CCD] = false;
+	engineParameters_[EP_PHYSICS_FPS] = DEFAULT_FPS;
+	engineParameters_[EP_FLOCK_SEND_RATE] = 10;
+	engineParameters_[EP_INTEREST_NEAR] = 50.0f;
+	engineParameters_[EP_INTEREST_CUTOFF] = 150.0f;
+	engineParameters_[EP_NETWORK_FPS] = 20;
+	engineParameters_[EP_INTERPOLATION_DELAY] = 0.15f;
+
+	const Vector<String>& arguments = GetArguments();
+	for (unsigned i = 0; i < arguments.Size(); ++i)
+	{
+		String argument = arguments[i].ToLower();
+		bool hasValue = i + 1 < arguments.Size();
+		if (argument == "-flocks" && hasValue)
+			engineParameters_[EP_FLOCK_COUNT] = ToUInt(arguments[++i]);
+		else if (argument == "-boids" && hasValue)
+			engineParameters_[EP_FLOCK_SIZE] = ToUInt(arguments[++i]);
+		else if (argument == "-boidcapacity" && hasValue)
+			engineParameters_[EP_FLOCK_CAPACITY] = ToUInt(arguments[++i]);
+		else if (argument == "-bullets" && hasValue)
+			engineParameters_[EP_BULLET_CAPACITY] = ToUInt(arguments[++i]);
+		else if (argument == "-physicsbullets")
+			engineParameters_[EP_BULLET_KINEMATIC] = false;
+		else if (argument == "-ccd")
+			engineParameters_[EP_BULLET_CCD] = true;
+		else if (argument == "-physicsfps" && hasValue)
+			engineParameters_[EP_PHYSICS_FPS] = Max(ToInt(arguments[++i]), 1);
+		else if (argument == "-physicsboids")
+			engineParameters_[EP_FLOCK_KINEMATIC] = false;
+		else if (argument == "-seed" && hasValue)
+			engineParameters_[EP_FLOCK_SEED] = ToUInt(arguments[++i]);
+		else if (argument == "-flocksendrate" && hasValue)
+			engineParameters_[EP_FLOCK_SEND_RATE] = Max(ToInt(arguments[++i]), 1);
+		else if (argument == "-interestnear" && hasValue)
+			engineParameters_[EP_INTEREST_NEAR] = Max(ToFloat(arguments[++i]), 0.0f);
+		else if (argument == "-interestcutoff" && hasValue)
+			engineParameters_[EP_INTEREST_CUTOFF] = Max(ToFloat(arguments[++i]), 0.0f);
+		else if (argument == "-netfps" && hasValue)
+			engineParameters_[EP_NETWORK_FPS] = Max(ToInt(arguments[++i]), 1);
+		else if (argument == "-interpdelay" && hasValue)
+			engineParameters_[EP_INTERPOLATION_DELAY] = Max(ToFloat(arguments[++i]), 0.0f);
+	}
+
+	// Capacity is only a floor, the requested size always fits
+	engineParameters_[EP_FLOCK_CAPACITY] = Max(engineParameters_[EP_FLOCK_CAPACITY].GetUInt(), engineParameters_[EP_FLOCK_SIZE].GetUInt());
+}
+
 void MainGame::Start()
 {
 	// Execute base class startup
@@ -100,12 +194,6 @@ void MainGame::Start()
 	if (touchEnabled_)
 		touch_ = new Touch(context_, TOUCH_SENSITIVITY);
 
-
-	for (int i = 0; i < numOfBoidSet; ++i)
-	{
-		boidSet[i] = new BoidSet();
-	}
-
 	// Subscribe to necessary events
 	SubscribeToEvents();
 
@@ -138,7 +226,7 @@ void MainGame::CreateCharacter()
 
 	// Create rigidbody, and set non-zero mass so that the body becomes dynamic
 	RigidBody* body = objectNode->CreateComponent<RigidBody>();
-	body->SetCollisionLayer(1);
+	SetCollisionKind(body, COLLISION_PLAYER);
 	body->SetMass(1.0f);
 
 	// Set zero angular factor so that physics doesn't turn the character on its own.
@@ -177,18 +265,14 @@ void MainGame::SubscribeToEvents()
 
 	SubscribeToEvent(E_CLIENTCONNECTED, URHO3D_HANDLER(MainGame, ServerConnect));
 
-	SubscribeToEvent(E_CLIENTDISCONNECTED, URHO3D_HANDLER(MainGame, HandleDisconnect));
+	SubscribeToEvent(E_CLIENTDISCONNECTED, URHO3D_HANDLER(MainGame, HandleClientDisconnected));
 
 	SubscribeToEvent(E_CLIENTSCENELOADED, URHO3D_HANDLER(MainGame, HandleClientFinishedLoading));
 
-	SubscribeToEvent(E_CUSTOMEVENT, URHO3D_HANDLER(MainGame, HandleCustomEvent));
-	GetSubsystem<Network>()->RegisterRemoteEvent(E_CUSTOMEVENT);
+	// Everything the game sends itself comes as a NetMessageID message
+	SubscribeToEvent(E_NETWORKMESSAGE, URHO3D_HANDLER(MainGame, HandleNetworkMessage));
 
-	SubscribeToEvent(E_CLIENTISREADY, URHO3D_HANDLER(MainGame, HandleClientToServerReady));
-	GetSubsystem<Network>()->RegisterRemoteEvent(E_CLIENTISREADY);
-
-	SubscribeToEvent(E_CLIENTOBJECTAUTHORITY, URHO3D_HANDLER(MainGame, HandleServerToClientObjects));
-	GetSubsystem<Network>()->RegisterRemoteEvent(E_CLIENTOBJECTAUTHORITY);
+	SubscribeToEvent(E_CONSOLECOMMAND, URHO3D_HANDLER(MainGame, HandleConsoleCommand));
 
 	//SubscribeToEvent(E_KEYDOWN, URHO3D_HANDLER(Sample, HandleKeyDown));
 
@@ -202,8 +286,6 @@ void MainGame::HandleUpdate(StringHash eventType, VariantMap& eventData)
 
 	Input* input = GetSubsystem<Input>();
 
-	float time = eventData[P_TIMESTEP].GetFloat();
-
 	if (character_)
 	{
 		// Clear previous controls
@@ -289,41 +371,81 @@ void MainGame::HandleUpdate(StringHash eventType, VariantMap& eventData)
 		menuVisable = !menuVisable;
 	}
 
-	//float calctime = 0;
-	for (int i = 0; i < numOfBoidSet; i++)
+}
+
+void MainGame::StepFlocks(float timeStep)
+{
+	flockTime += timeStep;
+	++flockSteps;
+
+	// Every flock's forces come from one shared index, so gather them all first and apply them all after
+	for (unsigned i = 0; i < boidSets.Size(); i++)
+	{
+		if (boidSets[i]->isActive)
+			boidSets[i]->Gather();
+	}
+	flockWorld.ComputeForces(GetSubsystem<WorkQueue>());
+
+	for (unsigned i = 0; i < boidSets.Size(); i++)
 	{
-		if (i % 4 == FrameSkipper % 4);
-		if (boidSet[i]->isActive)
-			boidSet[i]->Update(time);
-		//calctime += time;
+		if (boidSets[i]->isActive)
+			boidSets[i]->Update(timeStep);
+	}
+
+	// Record where the boids ended up, for rewinding shots from lagging clients
+	flockHistory.Record(flockTime);
 
+	// Snapshots go out at their own rate, a fraction of the step rate
+	flockSendTime += timeStep;
+	float sendInterval = 1.0f / Engine::GetParameter(engineParameters_, EP_FLOCK_SEND_RATE, 10).GetInt();
+	if (flockSendTime >= sendInterval)
+	{
+		flockSendTime = Min(flockSendTime - sendInterval, sendInterval);
+		flockSender.Send(GetSubsystem<Network>()->GetClientConnections(), flockTime);
 	}
-	FrameSkipper++;
 
-	//printf("Time to calc is %f\n", calctime);
+	if (bullets)
+	{
+		bullets->Update(timeStep);
 
+		// Sweep every bullet's move this step against all flocks
+		bullets->QueryHits(flockWorld, flockHistory, flockTime, BULLET_HIT_RADIUS, timeStep, hitQueue);
+	}
 
-	if (bullets != nullptr)
+	// At the rate node positions are replicated, faster would show nothing sooner
+	Network* network = GetSubsystem<Network>();
+	nodeInterestTime += timeStep;
+	float interestInterval = 1.0f / network->GetUpdateFps();
+	if (nodeInterestTime >= interestInterval)
 	{
-		bullets->Move();
+		nodeInterestTime = Min(nodeInterestTime - interestInterval, interestInterval);
+		nodeInterest.Send(network->GetClientConnections());
+	}
+}
 
-		if (bullets->pRigidBody != nullptr) {
-			Vector3 length = bullets->pRigidBody->GetPosition();
-			float d = length.Length();
-			if (d > 60.0f)
-			{
-				bullets->GetNode()->Remove();
-				bullets->~Bullet();
-				bullets = nullptr;
-			}
+void MainGame::ApplyHits()
+{
+	for (unsigned h = 0; h < hitQueue.GetNumHits(); h++)
+	{
+		const BoidHit& hit = hitQueue.GetHit(h);
+		for (unsigned i = 0; i < boidSets.Size(); i++)
+		{
+			// A boid hit by two bullets in one step only counts once
+			if (&boidSets[i]->flock == hit.flock && boidSets[i]->Kill(hit.boid))
+				++scores[hit.owner];
 		}
+		if (bullets)
+			bullets->Expire(hit.bullet);
 	}
+	hitQueue.Clear();
 }
 
-void MainGame::SubscribeToCollisions(Node* node)
+void MainGame::SubscribeToCollisions()
 {
-	if (node)
-		SubscribeToEvent(node, E_NODECOLLISION, URHO3D_HANDLER(MainGame, HandleCollisions));
+	// One handler for the whole world, collision masks and event modes keep it down to bullet contacts
+	PhysicsWorld* physicsWorld = scene_->GetComponent<PhysicsWorld>();
+	if (physicsWorld)
+		SubscribeToEvent(physicsWorld, E_PHYSICSCOLLISIONSTART, URHO3D_HANDLER(MainGame, HandleCollisions));
 }
 
 void MainGame::HandlePostUpdate(StringHash eventType, VariantMap& eventData)
@@ -334,12 +456,22 @@ void MainGame::HandlePostUpdate(StringHash eventType, VariantMap& eventData)
 	ui->GetCursor()->SetVisible(menuVisable);
 	window->SetVisible(menuVisable);
 
+	if (GetSubsystem<Network>()->GetServerConnection())
+	{
+		using namespace PostUpdate;
+		flockReceiver.UpdateRenderers(scene_, eventData[P_TIMESTEP].GetFloat());
+		nodeInterestReceiver.Update(scene_);
+		InterpolateRemotePlayers();
+	}
+
 	// Only move the camera if we have a controllable object 
 	if (clientObject)
 	{
 		Node* ballNode = this->scene_->GetNode(clientObject);
 		if (ballNode)
 		{
+			prediction.Apply(ballNode);
+
 			yaw += (float)input->GetMouseMoveX() * YAW_SENSITIVITY;
 			pitch += (float)input->GetMouseMoveY() * YAW_SENSITIVITY;
 
@@ -382,7 +514,7 @@ void MainGame::HandlePostUpdate(StringHash eventType, VariantMap& eventData)
 		Vector3 rayDir = dir * Vector3::BACK;
 		float rayDistance = touch_ ? touch_->cameraDistance_ : CAMERA_INITIAL_DIST;
 		PhysicsRaycastResult result;
-		scene_->GetComponent<PhysicsWorld>()->RaycastSingle(result, Ray(aimPoint, rayDir), rayDistance, 2);
+		scene_->GetComponent<PhysicsWorld>()->RaycastSingle(result, Ray(aimPoint, rayDir), rayDistance, COLLISION_WORLD);
 		if (result.body_)
 			rayDistance = Min(rayDistance, result.distance_);
 		rayDistance = Clamp(rayDistance, CAMERA_MIN_DIST, CAMERA_MAX_DIST);
@@ -444,7 +576,7 @@ void MainGame::CreateClientScene()
 	RigidBody* body = floorNode->CreateComponent<RigidBody>(LOCAL);
 	// Use collision layer bit 2 to mark world scenery. This is what we will raycast against to prevent camera from going
 	// inside geometry
-	body->SetCollisionLayer(2);
+	SetCollisionKind(body, COLLISION_WORLD);
 	CollisionShape* shape = floorNode->CreateComponent<CollisionShape>(LOCAL);
 	shape->SetBox(Vector3::ONE);
 
@@ -459,7 +591,8 @@ void MainGame::CreateServerScene()
 	scene_ = new Scene(context_);
 	// Create scene subsystem components
 	scene_->CreateComponent<Octree>(LOCAL);
-	scene_->CreateComponent<PhysicsWorld>(LOCAL);
+	PhysicsWorld* physicsWorld = scene_->CreateComponent<PhysicsWorld>(LOCAL);
+	physicsWorld->SetFps(Engine::GetParameter(engineParameters_, EP_PHYSICS_FPS, DEFAULT_FPS).GetInt());
 
 	Node* skyNode = scene_->CreateChild("Sky");
 	Skybox* skybox = skyNode->CreateComponent<Skybox>();
@@ -504,7 +637,7 @@ void MainGame::CreateServerScene()
 	RigidBody* body = floorNode->CreateComponent<RigidBody>();
 	// Use collision layer bit 2 to mark world scenery. This is what we will raycast against to prevent camera from going
 	// inside geometry
-	body->SetCollisionLayer(2);
+	SetCollisionKind(body, COLLISION_WORLD);
 	CollisionShape* shape = floorNode->CreateComponent<CollisionShape>();
 	shape->SetBox(Vector3::ONE);
 
@@ -518,17 +651,91 @@ void MainGame::CreateServerScene()
 	Areanobject->SetCastShadows(true);
 
 	RigidBody* Areanbody = AreanNode->CreateComponent<RigidBody>();
-	Areanbody->SetCollisionLayer(2);
+	SetCollisionKind(Areanbody, COLLISION_WORLD);
 	CollisionShape* Areanshape = AreanNode->CreateComponent<CollisionShape>();
 	Areanshape->SetTriangleMesh(Areanobject->GetModel(), 0);
 
 	//create tge biuds
-	for (int i = 0; i < numOfBoidSet; i++)
+	CreateFlocks();
+	CreateBullets();
+}
+
+void MainGame::CreateFlocks()
+{
+	ResourceCache* cache = GetSubsystem<ResourceCache>();
+
+	unsigned count = Engine::GetParameter(engineParameters_, EP_FLOCK_COUNT).GetUInt();
+	unsigned size = Engine::GetParameter(engineParameters_, EP_FLOCK_SIZE).GetUInt();
+	unsigned capacity = Engine::GetParameter(engineParameters_, EP_FLOCK_CAPACITY).GetUInt();
+	bool kinematic = Engine::GetParameter(engineParameters_, EP_FLOCK_KINEMATIC, true).GetBool();
+	// A given seed replays the same spawns, 0 picks a fresh one each run
+	unsigned seed = Engine::GetParameter(engineParameters_, EP_FLOCK_SEED).GetUInt();
+	if (!seed)
+		seed = Time::GetSystemTime();
+	Log::WriteRaw("Flock seed: " + String(seed) + "\n");
+
+	flockTime = 0.0f;
+	flockSteps = 0;
+	flockHistory.Clear();
+	flockWorld.Clear();
+	boidSets.Clear();
+	for (unsigned i = 0; i < count; i++)
+	{
+		SharedPtr<BoidSet> boidSet(new BoidSet());
+		boidSet->Initialise(cache, scene_, capacity, size, kinematic, seed + i);
+		boidSet->isActive = true;
+		boidSet->flock.species = i % MAX_FLOCK_SPECIES;
+		boidSets.Push(boidSet);
+		flockWorld.AddFlock(&boidSet->flock);
+	}
+
+	// Flocks keep clear of each other but only school with their own kind
+	for (unsigned i = 0; i < Min(count, MAX_FLOCK_SPECIES); i++)
 	{
-		boidSet[i]->Initialise(cache, scene_);
-		boidSet[i]->isActive = true;
+		for (unsigned j = 0; j < Min(count, MAX_FLOCK_SPECIES); j++)
+		{
+			if (i != j)
+				flockWorld.SetInteraction(i, j, 0.0f, 1.0f);
+		}
 	}
 
+	flockHistory.Initialise(boidSets, flockWorld, HISTORY_FRAMES);
+	flockSender.Initialise(boidSets);
+	flockSender.SetInterest(GetInterest());
+	flockSendTime = 0.0f;
+	nodeInterestTime = 0.0f;
+}
+
+InterestRange MainGame::GetInterest() const
+{
+	InterestRange range;
+	range.cutoff = Engine::GetParameter(engineParameters_, EP_INTEREST_CUTOFF).GetFloat();
+	range.nearDistance = Min(Engine::GetParameter(engineParameters_, EP_INTEREST_NEAR).GetFloat(), range.cutoff);
+	range.farInterval = INTEREST_FAR_INTERVAL;
+	if (range.cutoff <= 0.0f)
+		range = INTEREST_UNLIMITED;
+	return range;
+}
+
+void MainGame::CreateBullets()
+{
+	ResourceCache* cache = GetSubsystem<ResourceCache>();
+
+	unsigned capacity = Engine::GetParameter(engineParameters_, EP_BULLET_CAPACITY).GetUInt();
+	bool kinematic = Engine::GetParameter(engineParameters_, EP_BULLET_KINEMATIC, true).GetBool();
+
+	bullets = new BulletSet();
+	bullets->Initialise(cache, scene_, capacity, kinematic);
+	// Below about moveSpeed / radius steps per second a bullet can step over a boid, continuous collision catches those
+	PhysicsWorld* physicsWorld = scene_->GetComponent<PhysicsWorld>();
+	bullets->SetContinuous(Engine::GetParameter(engineParameters_, EP_BULLET_CCD, false).GetBool(), 1.0f / physicsWorld->GetFps());
+	// Room for every bullet to hit once by sweep and once by contact in a step
+	hitQueue.SetCapacity(bullets->GetCapacity() * 2);
+	nodeInterest.SetInterest(GetInterest());
+	bullets->SetInterest(nodeInterest);
+	// Kinematic bullets have no bodies, their hits only come from the sweep in StepFlocks
+	if (!kinematic)
+		SubscribeToCollisions();
 }
 
 Controls MainGame::FromClientToServer()
@@ -645,6 +852,11 @@ void MainGame::CloseMenu(StringHash eventType, VariantMap& eventData)
 void MainGame::HandleConnect(StringHash eventType, VariantMap& eventData)
 {
 	CreateClientScene();
+	flockReceiver.Clear();
+	nodeInterestReceiver.Clear();
+	prediction.Clear();
+	flockReceiver.SetDelay(Engine::GetParameter(engineParameters_, EP_INTERPOLATION_DELAY).GetFloat());
+	flockReceiver.SetMaxExtrapolation(MAX_EXTRAPOLATION);
 
 	Network* network = GetSubsystem<Network>();
 
@@ -654,11 +866,6 @@ void MainGame::HandleConnect(StringHash eventType, VariantMap& eventData)
 		address = "localhost";
 
 	network->Connect(address, SERVER_PORT, scene_);
-
-	//VariantMap remoteData;
-	//remoteData["aValueRemoteValue"] = 0;
-	//network->BroadcastRemoteEvent(E_CUSTOMEVENT, true, remoteData);
-
 }
 
 void MainGame::ServerConnect(StringHash eventType, VariantMap& eventData)
@@ -672,10 +879,29 @@ void MainGame::ServerConnect(StringHash eventType, VariantMap& eventData)
 	Connection* newConnection = static_cast<Connection*>(eventData[P_CONNECTION].GetPtr());
 
 	newConnection->SetScene(scene_);
+	// Its commands start again from 1, and it has no player yet
+	ForgetClient(newConnection);
+}
+
+void MainGame::HandleClientDisconnected(StringHash eventType, VariantMap& eventData)
+{
+	using namespace ClientDisconnected;
+
+	Connection* connection = static_cast<Connection*>(eventData[P_CONNECTION].GetPtr());
 
-	VariantMap remoteData;
-	remoteData["aValueRemoteValue"] = 0;
-	newConnection->SendRemoteEvent(E_CUSTOMEVENT, true, remoteData);
+	HashMap<Connection*, WeakPtr<Node> >::Iterator player = serverObjects.Find(connection);
+	if (player != serverObjects.End() && player->second_)
+		player->second_->Remove();
+	ForgetClient(connection);
+}
+
+void MainGame::ForgetClient(Connection* connection)
+{
+	serverObjects.Erase(connection);
+	clientCommands.Erase(connection);
+	nextFireTime.Erase(connection);
+	flockSender.RemoveClient(connection);
+	nodeInterest.RemoveClient(connection);
 }
 
 void MainGame::HandleDisconnect(StringHash eventType, VariantMap& eventData)
@@ -692,6 +918,9 @@ void MainGame::HandleDisconnect(StringHash eventType, VariantMap& eventData)
 		serverConnection->Disconnect();
 
 		scene_->Clear();
+		flockReceiver.Clear();
+		nodeInterestReceiver.Clear();
+		prediction.Clear();
 
 		clientObject = 0;
 	}
@@ -700,10 +929,17 @@ void MainGame::HandleDisconnect(StringHash eventType, VariantMap& eventData)
 	{
 		network->StopServer();
 
-		for (int i = 0; i < numOfBoidSet; i++)
-		{
-			boidSet[i]->isActive = false;
-		}
+		flockSender.Clear();
+		nodeInterest.Clear();
+		flockHistory.Clear();
+		flockWorld.Clear();
+		boidSets.Clear();
+		bullets.Reset();
+		hitQueue.Clear();
+		scores.Clear();
+		serverObjects.Clear();
+		nextFireTime.Clear();
+		clientCommands.Clear();
 
 		scene_->Clear();
 	}
@@ -714,6 +950,7 @@ void MainGame::HandleStartServer(StringHash eventType, VariantMap& eventData)
 	CreateServerScene();
 
 	Network* network = GetSubsystem<Network>();
+	network->SetUpdateFps(Engine::GetParameter(engineParameters_, EP_NETWORK_FPS).GetInt());
 	network->StartServer(SERVER_PORT);
 	menuVisable = !menuVisable;
 
@@ -731,7 +968,7 @@ Controls MainGame::ClientToSeverControls()
 	controls.Set(CTRL_LEFT, input->GetKeyDown(KEY_A));
 	controls.Set(CTRL_RIGHT, input->GetKeyDown(KEY_D));
 
-	controls.Set(1024, input->GetKeyDown(KEY_E));
+	controls.Set(CTRL_FIRE, input->GetKeyDown(KEY_E));
 	// mouse yaw to server
 	controls.yaw_ = yaw;
 	controls.pitch_ = pitch;
@@ -739,7 +976,7 @@ Controls MainGame::ClientToSeverControls()
 	return controls;
 }
 
-void MainGame::ProcessControls()
+void MainGame::ProcessControls(float timeStep)
 {
 	Network* network = GetSubsystem<Network>();
 
@@ -753,51 +990,78 @@ void MainGame::ProcessControls()
 			continue;
 
 		RigidBody* body = ballNode->GetComponent<RigidBody>();
-
-		const Controls& controls = connection->GetControls();
-
-		Quaternion rotation(0, controls.yaw_, 0);
-
-		const float moveTorque = .1f;
-
-		if (controls.buttons_ & CTRL_FORWARD)
-			printf("Received from Client: Controls buttons FORWARD \n");
-		if (controls.buttons_ & CTRL_BACK)
-			printf("Received from Client: Controls buttons BACK \n");
-		if (controls.buttons_ & CTRL_LEFT)
-			printf("Received from Client: Controls buttons LEFT \n");
-		if (controls.buttons_ & CTRL_RIGHT)
-			printf("Received from Client: Controls buttons RIGHT \n");
-
-		if (controls.buttons_ & CTRL_FORWARD)
-			body->SetPosition(body->GetPosition() + rotation * Vector3::FORWARD * moveTorque);
-		if (controls.buttons_ & CTRL_BACK)
-			body->SetPosition(body->GetPosition() + rotation * Vector3::BACK * moveTorque);
-		if (controls.buttons_ & CTRL_RIGHT)
-			body->SetPosition(body->GetPosition() + rotation * Vector3::RIGHT * moveTorque);
-		if (controls.buttons_ & CTRL_LEFT)
-			body->SetPosition(body->GetPosition() + rotation * Vector3::LEFT * moveTorque);
+		ClientCommands& commands = clientCommands[connection];
+
+		// Every command the client sent since the last step, in order, each moving it as the client predicted
+		// as long as the time they claim fits in what has really passed
+		commands.budget = Min(commands.budget + timeStep * MOVE_BUDGET_RATE, MAX_MOVE_BUDGET);
+		Vector3 position = body->GetPosition();
+		Quaternion rotation = body->GetRotation();
+		for (unsigned c = 0; c < commands.queue.Size(); ++c)
+		{
+			const PlayerCommand& command = commands.queue[c];
+			float step = Min(command.timeStep, commands.budget);
+			commands.budget -= step;
+			ApplyPlayerControls(command.buttons, command.yaw, step, position, rotation);
+			if (command.buttons & CTRL_FIRE)
+				FireBullet(connection, ballNode, position, command.yaw, command.viewTime);
+		}
+		commands.queue.Clear();
+		body->SetPosition(position);
 		body->SetRotation(rotation);
 
-		if (controls.buttons_ & 1024)
-		{
-			printf("Creating a bullet\n");
+		// Where the client's prediction restarts from, unreliable as the next step sends it again
+		PlayerStateMessage state;
+		state.applied = commands.applied;
+		state.position = position;
+		state.rotation = rotation;
+		SendFixedMessage(connection, state, netMessage);
+	}
+}
 
-			if (bullets != nullptr)
-				break;
+void MainGame::FireBullet(Connection* connection, Node* ballNode, const Vector3& position, float aimYaw, float viewTime)
+{
+	// Held fire repeats at FIRE_INTERVAL, and a client at its budget waits for a bullet to expire
+	float& nextFire = nextFireTime[connection];
+	if (flockTime < nextFire || !bullets || bullets->GetNumLive(ballNode->GetID()) >= MAX_CLIENT_BULLETS)
+		return;
 
-			Bullet* b = new Bullet(Quaternion(0, controls.yaw_, 0));
+	nextFire = flockTime + FIRE_INTERVAL;
 
-			ResourceCache* cache = GetSubsystem<ResourceCache>();
-			b->Initialize(cache, scene_, body->GetPosition()+ Vector3(0,1,0));
-			if (bullets == nullptr) {
-				bullets = b;
-				SubscribeToCollisions(b->GetNode());
-			}
-		}
-	}
+	// The shot leaves from where the command put the player, which is where the client's prediction had it.
+	// Only the boids are rewound, to what the client was showing when it pressed fire. Without a view time yet it saw no boids
+	float lag = viewTime >= 0.0f ? Clamp(flockTime - viewTime, 0.0f, MAX_REWIND) : 0.0f;
+	bullets->Fire(position + Vector3(0, 1, 0), Quaternion(0, aimYaw, 0), ballNode->GetID(), lag);
 }
 
+void MainGame::HandlePlayerInput(Connection* connection, MemoryBuffer& message)
+{
+	ClientCommands& commands = clientCommands[connection];
+	unsigned first = message.ReadUInt();
+	unsigned count = message.ReadVLE();
+	float viewTime = message.ReadFloat();
+	// No honest client sends more, or gets further ahead than it keeps unacknowledged
+	if (count > MAX_INPUT_COMMANDS || first > commands.applied + MAX_PENDING_COMMANDS)
+		return;
+
+	// Each message repeats the commands not yet acknowledged, so only the new ones are queued
+	for (unsigned i = 0; i < count && !message.IsEof(); ++i)
+	{
+		PlayerCommand command;
+		command.sequence = first + i;
+		command.buttons = message.ReadUShort();
+		command.yaw = message.ReadFloat();
+		command.timeStep = message.ReadUByte() / 1000.0f;
+		float behind = message.ReadUShort() / 1000.0f;
+		command.viewTime = viewTime >= 0.0f ? viewTime - behind : -1.0f;
+		if (command.sequence <= commands.applied)
+			continue;
+		// Past the cap the commands are dropped but still acknowledged, so the client replays without them
+		if (commands.queue.Size() < MAX_QUEUED_COMMANDS)
+			commands.queue.Push(command);
+		commands.applied = command.sequence;
+	}
+}
 
 void MainGame::HandlePhysicsPre(StringHash eventType, VariantMap& eventData)
 {
@@ -806,14 +1070,28 @@ void MainGame::HandlePhysicsPre(StringHash eventType, VariantMap& eventData)
 
 	if (serverConnection) {
 		serverConnection->SetPosition(cameraNode_->GetPosition());
-		serverConnection->SetControls(ClientToSeverControls());
 
-		VariantMap remoteData;
-		remoteData["aValueRemoteValue"] = 0;
-		serverConnection->SendRemoteEvent(E_CUSTOMEVENT, true, remoteData);
+		// Our own player moves now and is corrected when the server catches up
+		if (clientObject)
+		{
+			using namespace PhysicsPreStep;
+			Controls controls = ClientToSeverControls();
+			prediction.Step(controls.buttons_, controls.yaw_, eventData[P_TIMESTEP].GetFloat(), flockReceiver.GetShownTime(),
+				serverConnection);
+		}
+
+		flockReceiver.SendAcks(serverConnection);
 	}
 	else if (network->IsServerRunning()) {
-		ProcessControls();
+		// Last step's sweep hits and the physics step's contacts are applied together. Before firing, which can
+		// recycle the slot of a bullet that has hit, and before Gather packs the flocks and the hits' indices go stale
+		ApplyHits();
+
+		using namespace PhysicsPreStep;
+		ProcessControls(eventData[P_TIMESTEP].GetFloat());
+
+		// Flocks step with physics, at its fixed rate however the frame rate varies
+		StepFlocks(eventData[P_TIMESTEP].GetFloat());
 	}
 }
 
@@ -822,27 +1100,90 @@ void MainGame::HandleClientFinishedLoading(StringHash eventType, VariantMap& eve
 	printf("Client Scene Loaded");
 }
 
-void MainGame::HandleCustomEvent(StringHash eventType, VariantMap& eventData)
+void MainGame::HandleNetworkMessage(StringHash eventType, VariantMap& eventData)
 {
-	printf("This is a custom event\n\n");
+	using namespace NetworkMessage;
+
+	Connection* connection = static_cast<Connection*>(eventData[P_CONNECTION].GetPtr());
+	const PODVector<unsigned char>& data = eventData[P_DATA].GetBuffer();
+	MemoryBuffer message(data);
+
+	// Each message only comes one way, anything else is ignored
+	Network* network = GetSubsystem<Network>();
+	bool fromServer = connection == network->GetServerConnection();
+	bool fromClient = !fromServer && network->IsServerRunning();
+
+	switch (eventData[P_MESSAGEID].GetInt())
+	{
+	case MSG_FLOCK_SNAPSHOT:
+		if (fromServer)
+			flockReceiver.HandleSnapshot(message);
+		break;
+	case MSG_FLOCK_DROP:
+		if (fromServer)
+			flockReceiver.HandleDrop(message);
+		break;
+	case MSG_PLAYER_STATE:
+		if (fromServer)
+			prediction.HandleState(message);
+		break;
+	case MSG_NODE_INTEREST:
+		if (fromServer)
+			nodeInterestReceiver.HandleInterest(message);
+		break;
+	case MSG_PLAYER_AUTHORITY:
+		if (fromServer)
+		{
+			PlayerAuthorityMessage authority;
+			if (ReadFixedMessage(message, authority))
+				HandlePlayerAuthority(authority);
+		}
+		break;
+	case MSG_FLOCK_ACK:
+		if (fromClient)
+			flockSender.HandleAck(connection, message);
+		break;
+	case MSG_PLAYER_INPUT:
+		if (fromClient)
+			HandlePlayerInput(connection, message);
+		break;
+	case MSG_CLIENT_READY:
+		if (fromClient)
+			HandleClientReady(connection);
+		break;
+	}
 }
 
 void MainGame::HandleCollisions(StringHash eventType, VariantMap& eventData)
 {
-	using namespace NodeCollision;
+	using namespace PhysicsCollisionStart;
 
-	RigidBody* bullet = static_cast<RigidBody*>(eventData[P_BODY].GetPtr());
-	RigidBody* bird = static_cast<RigidBody*>(eventData[P_OTHERBODY].GetPtr());
+	RigidBody* bullet = static_cast<RigidBody*>(eventData[P_BODYA].GetPtr());
+	RigidBody* bird = static_cast<RigidBody*>(eventData[P_BODYB].GetPtr());
+	if (!bullet || !bird)
+		return;
 
-	//printf("%s\n", bird->GetNode()->GetName());
+	if (GetCollisionKind(bird) == COLLISION_BULLET)
+		Swap(bullet, bird);
 
-	if (bird->GetNode()->GetName().Contains("Boid"))
-	{
-		printf("Collision is Occouring\n");
+	if (GetCollisionKind(bullet) != COLLISION_BULLET || GetCollisionKind(bird) != COLLISION_BOID || !bullets)
+		return;
 
-		bird->SetUseGravity(true);
-		bird->SetLinearVelocity(Vector3::ZERO);
-		bullet->SetPosition(Vector3(100, 100, 100));
+	// Only record the hit, nothing may change inside the physics step
+	BoidHit hit;
+	hit.bullet = bullets->FindSlot(bullet);
+	if (!bullets->IsLive(hit.bullet))
+		return;
+	hit.owner = bullets->GetOwner(hit.bullet);
+	for (unsigned i = 0; i < boidSets.Size(); i++)
+	{
+		hit.boid = boidSets[i]->FindIndex(bird);
+		if (hit.boid != M_MAX_UNSIGNED)
+		{
+			hit.flock = &boidSets[i]->flock;
+			hitQueue.Push(hit);
+			return;
+		}
 	}
 }
 
@@ -863,6 +1204,7 @@ Node* MainGame::CreateControllableObject()
 	cam->CreateComponent<Camera>();
 
 	RigidBody* body = ballNode->CreateComponent<RigidBody>();
+	SetCollisionKind(body, COLLISION_PLAYER);
 	body->SetMass(1.0f);
 	body->SetFriction(1.0f);
 	body->SetLinearDamping(0.25f);
@@ -871,31 +1213,92 @@ Node* MainGame::CreateControllableObject()
 	CollisionShape* shape = ballNode->CreateComponent<CollisionShape>();
 	shape->SetSphere(0.5f);
 
+	nodeInterest.AddNode(ballNode);
+
 	return ballNode;
 }
 
-void MainGame::HandleServerToClientObjects(StringHash eventType, VariantMap& eventData)
+void MainGame::InterpolateRemotePlayers()
 {
-	clientObject = eventData[PLAYER_ID].GetUInt();
-	printf("Client ID : %i \n", clientObject);
+	// Until the server names our own player it can't be told apart
+	if (!clientObject)
+		return;
+
+	float delay = Engine::GetParameter(engineParameters_, EP_INTERPOLATION_DELAY).GetFloat();
+
+	// Players arrive by replication whenever they join, so look for new ones each frame. Our own is left alone
+	const Vector<SharedPtr<Node> >& children = scene_->GetChildren();
+	for (unsigned i = 0; i < children.Size(); ++i)
+	{
+		Node* node = children[i];
+		if (node->GetName() != "AClientBall" || node->GetID() == clientObject || node->GetComponent<InterpolatedTransform>())
+			continue;
+
+		InterpolatedTransform* interpolation = node->CreateComponent<InterpolatedTransform>(LOCAL);
+		interpolation->SetDelay(delay);
+		interpolation->SetMaxExtrapolation(MAX_EXTRAPOLATION);
+	}
 }
 
-void MainGame::HandleClientToServerReady(StringHash eventType, VariantMap& eventData)
+void MainGame::HandlePlayerAuthority(const PlayerAuthorityMessage& message)
 {
-	printf("Event sent by the client and running on server:");
+	clientObject = message.nodeID;
+	URHO3D_LOGDEBUG("Controlling player node " + String(clientObject));
+	prediction.Clear();
+}
 
-	using namespace ClientConnected;
-	Connection* newConnection = static_cast<Connection*>(eventData[P_CONNECTION].GetPtr());
+void MainGame::HandleClientReady(Connection* connection)
+{
+	// Reliable, but a client pressing start twice still only gets one player
+	if (serverObjects.Contains(connection))
+		return;
 
 	Node* newObject = CreateControllableObject();
-	serverObjects[newConnection] = newObject;
+	serverObjects[connection] = newObject;
 
-	VariantMap remoteEventData;
-	remoteEventData[PLAYER_ID] = newObject->GetID();
-	newConnection->SendRemoteEvent(E_CLIENTOBJECTAUTHORITY, true, remoteEventData);
+	PlayerAuthorityMessage authority;
+	authority.nodeID = newObject->GetID();
+	SendFixedMessage(connection, authority, netMessage);
 	menuVisable = false;
 }
 
+void MainGame::HandleConsoleCommand(StringHash eventType, VariantMap& eventData)
+{
+	using namespace ConsoleCommand;
+
+	if (eventData[P_ID].GetString() != GetTypeName())
+		return;
+
+	Vector<String> tokens = eventData[P_COMMAND].GetString().Split(' ');
+	if (tokens.Size() == 2 && tokens[0] == "boids")
+	{
+		unsigned count = ToUInt(tokens[1]);
+		// Despawning moves boids, so settle pending hits while their indices still hold
+		ApplyHits();
+		// Each flock stops at its pool capacity, report what it actually got
+		for (unsigned i = 0; i < boidSets.Size(); i++)
+		{
+			boidSets[i]->SetNumBoids(count);
+			unsigned applied = boidSets[i]->GetNumBoids();
+			if (applied < count)
+				Log::WriteRaw("Flock " + String(i) + ": " + String(applied) + " boids, capped at its capacity of " + String(boidSets[i]->GetCapacity()) + "\n");
+			else
+				Log::WriteRaw("Flock " + String(i) + ": " + String(applied) + " boids\n");
+		}
+	}
+	else if (tokens.Size() == 1 && tokens[0] == "flockhash")
+	{
+		// Two runs with the same seed and inputs print the same hash at the same step
+		Log::WriteRaw("Flock step " + String(flockSteps) + " hash " + ToStringHex(flockWorld.GetStateHash()) + "\n");
+	}
+	else if (tokens.Size() == 1 && tokens[0] == "flocknet")
+	{
+		unsigned clients = GetSubsystem<Network>()->GetClientConnections().Size();
+		float kbPerSecond = flockTime > 0.0f ? flockSender.GetBytesSent() / 1024.0f / flockTime : 0.0f;
+		Log::WriteRaw("Flock snapshots " + String(kbPerSecond) + " KB/s to " + String(clients) + " clients\n");
+	}
+}
+
 void MainGame::HandleClientStartGame(StringHash eventType, VariantMap& eventData)
 {
 	printf("Client has pressed START GAME \n");
@@ -905,9 +1308,8 @@ void MainGame::HandleClientStartGame(StringHash eventType, VariantMap& eventData
 		Connection* serverConnection = network->GetServerConnection();
 		if (serverConnection)
 		{
-			VariantMap remoteEventData;
-			remoteEventData[PLAYER_ID] = 0;
-			serverConnection->SendRemoteEvent(E_CLIENTISREADY, true, remoteEventData);
+			netMessage.Clear();
+			SendNetMessage(serverConnection, MSG_CLIENT_READY, netMessage);
 		}
 		menuVisable = false;
 	}
@@ -28,6 +28,12 @@
 #include <Urho3D/IO/Log.h>
 
 #include "Sample.h"
+#include "FlockHistory.h"
+#include "FlockSnapshot.h"
+#include "FlockWorld.h"
+#include "HitQueue.h"
+#include "NetMessages.h"
+#include "PlayerPrediction.h"
 
 namespace Urho3D
 {
@@ -38,6 +44,8 @@ class Window;
 
 }
 
+class BoidSet;
+class BulletSet;
 class Character;
 class Touch;
 
@@ -60,6 +68,8 @@ public:
     /// Destruct.
     ~MainGame();
 
+    /// Setup before engine initialization. Reads the flock sizing options from the command line.
+    virtual void Setup();
     /// Setup after engine initialization and before running the main loop.
     virtual void Start();
 
@@ -122,7 +132,8 @@ private:
     /// Handle application update. Set controls to character.
     void HandleUpdate(StringHash eventType, VariantMap& eventData);
 
-	void SubscribeToCollisions(Node* node);
+	/// Subscribe to contacts of the server physics world, which only physics bullets report.
+	void SubscribeToCollisions();
     /// Handle application post-update. Update camera position after character has moved.
     void HandlePostUpdate(StringHash eventType, VariantMap& eventData);
 	void CreateMainMenu();
@@ -138,14 +149,25 @@ private:
 	void HandleDisconnect(StringHash eventType, VariantMap& eventData);
 	void HandleStartServer(StringHash eventType, VariantMap& eventData);
 	Controls ClientToSeverControls();
-	void ProcessControls();
+	/// Apply the commands each client sent since the last server step of timeStep and send it back where its player ended up.
+	void ProcessControls(float timeStep);
+	/// Queue the new commands of a MSG_PLAYER_INPUT from a client.
+	void HandlePlayerInput(Connection* connection, MemoryBuffer& message);
+	/// Fire a client's bullet from position if its cooldown and bullet budget allow.
+	/// Its hits are rewound to viewTime, the server time the client was showing when it fired.
+	void FireBullet(Connection* connection, Node* ballNode, const Vector3& position, float aimYaw, float viewTime);
 	void HandlePhysicsPre(StringHash eventType, VariantMap& eventData);
 	void HandleClientFinishedLoading(StringHash eventType, VariantMap& eventData);
-	void HandleCustomEvent(StringHash eventType, VariantMap& eventData);
+	/// Route each NetMessageID message to its handler, if it came from the side that sends it.
+	void HandleNetworkMessage(StringHash eventType, VariantMap& eventData);
 	void HandleCollisions(StringHash eventType, VariantMap& eventData);
 	void CreateClientScene();
 
 	void ServerConnect(StringHash eventType, VariantMap& eventData);
+	/// Remove a disconnected client's player and forget it, on the server.
+	void HandleClientDisconnected(StringHash eventType, VariantMap& eventData);
+	/// Drop everything kept per connection. Connections are pointers, a new one can reuse a gone one's address.
+	void ForgetClient(Connection* connection);
 	void CreateServerScene();
 
 	Controls FromClientToServer();
@@ -165,10 +187,75 @@ private:
 	unsigned clientObject = 0;
 	HashMap<Connection*, WeakPtr<Node>> serverObjects;
 
-	void HandleServerToClientObjects(StringHash eventType, VariantMap& eventData);
-	void HandleClientToServerReady(StringHash eventType, VariantMap& eventData);
+	/// Take the node a MSG_PLAYER_AUTHORITY names as our player, on a client.
+	void HandlePlayerAuthority(const PlayerAuthorityMessage& message);
+	/// Give every other player's replicated node an InterpolatedTransform, on a client.
+	void InterpolateRemotePlayers();
+	/// Create a player for a client that sent MSG_CLIENT_READY and tell it which node it is.
+	void HandleClientReady(Connection* connection);
 	void HandleClientStartGame(StringHash eventType, VariantMap& eventData);
 
 	float yaw = 0;
 	float pitch = 0;
+
+	/// Server flocks, created with the server scene.
+	Vector<SharedPtr<BoidSet> > boidSets;
+	/// Shared neighbour index of the server flocks, each flock is its own species and avoids the others.
+	FlockWorld flockWorld;
+	/// Recent server flock and player positions, for rewinding shots to what their client saw.
+	FlockHistory flockHistory;
+	/// Create the server flocks from the FlockCount, FlockSize and FlockCapacity engine parameters.
+	void CreateFlocks();
+	/// Server bullet pool, created with the server scene.
+	SharedPtr<BulletSet> bullets;
+	/// Create the server bullet pool from the BulletCapacity and BulletKinematic engine parameters.
+	void CreateBullets();
+	/// Hits found during the step, applied in one batch by ApplyHits.
+	HitQueue hitQueue;
+	/// Kills per shooting node ID.
+	HashMap<unsigned, unsigned> scores;
+	/// Flock time at which each client may fire again.
+	HashMap<Connection*, float> nextFireTime;
+	/// Commands received from a client, waiting for the next step.
+	struct ClientCommands
+	{
+		ClientCommands() : applied(0), budget(0.0f) {}
+
+		/// Newest command queued, the ones up to it are acknowledged with the next state.
+		unsigned applied;
+		/// Seconds of movement the client may still use. Refilled by the server's own steps, so claiming
+		/// longer or more steps than really passed can't move a player faster.
+		float budget;
+		PODVector<PlayerCommand> queue;
+	};
+	HashMap<Connection*, ClientCommands> clientCommands;
+	/// Reusable buffer for outgoing fixed size messages.
+	VectorBuffer netMessage;
+	/// Client side prediction of our own player.
+	PlayerPrediction prediction;
+	/// Kill the boids, expire the bullets and credit the shooters of every queued hit, then clear the queue.
+	void ApplyHits();
+	/// Step the flocks and bullets by one physics step, so a seed and the same inputs replay the same flight.
+	/// The queued hits must have been applied first.
+	void StepFlocks(float timeStep);
+	/// Simulated time and steps since the flocks were created.
+	float flockTime = 0.0f;
+	unsigned flockSteps = 0;
+	/// Server side of the flock snapshot channel, sending at the FlockSendRate engine parameter.
+	FlockSnapshotSender flockSender;
+	/// What each client is sent, from the InterestNear and InterestCutoff engine parameters.
+	InterestRange GetInterest() const;
+	/// Flock time since the last snapshot send.
+	float flockSendTime = 0.0f;
+	/// Client side of the flock snapshot channel.
+	FlockSnapshotReceiver flockReceiver;
+	/// Hides the server's bullets and players from the clients out of range of them, at the network update rate.
+	NodeInterestSender nodeInterest;
+	/// Flock time since the last node interest send.
+	float nodeInterestTime = 0.0f;
+	/// Client side of node interest.
+	NodeInterestReceiver nodeInterestReceiver;
+	/// Handle console commands, "boids <count>" resizes every flock within its capacity, "flockhash" prints the flock state hash,
+	/// "flocknet" the snapshot bandwidth.
+	void HandleConsoleCommand(StringHash eventType, VariantMap& eventData);
 };
@@ -0,0 +1,110 @@
+#pragma once
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Math/Quaternion.h>
+#include <Urho3D/Network/Connection.h>
+
+using namespace Urho3D;
+
+/// Fixed IDs of the game's network messages, clear of the engine's own. Append only, so builds can talk.
+enum NetMessageID
+{
+	/// Server to client, a chunk of a flock. See FlockSnapshotSender.
+	MSG_FLOCK_SNAPSHOT = 0x100,
+	/// Client to server, the flock chunks decoded.
+	MSG_FLOCK_ACK = 0x101,
+	/// Server to client, a flock chunk has left the client's range.
+	MSG_FLOCK_DROP = 0x102,
+	/// Client to server, the player commands not yet acknowledged. See PlayerPrediction.
+	MSG_PLAYER_INPUT = 0x103,
+	/// Server to client, a PlayerStateMessage.
+	MSG_PLAYER_STATE = 0x104,
+	/// Client to server, no payload. The client wants a player to control.
+	MSG_CLIENT_READY = 0x105,
+	/// Server to client, a PlayerAuthorityMessage.
+	MSG_PLAYER_AUTHORITY = 0x106,
+	/// Server to client, nodes that have left or come back into the client's range. See NodeInterestSender.
+	MSG_NODE_INTEREST = 0x107
+};
+
+/// How a message type is sent. Reliable messages are resent until they arrive, in order ones arrive in
+/// the order sent, and an unreliable in order one is dropped if a newer one got there first.
+struct NetDelivery
+{
+	bool reliable;
+	bool inOrder;
+};
+
+/// Delivery of each message type, so every send of a type goes the same way.
+inline NetDelivery GetNetDelivery(NetMessageID id)
+{
+	NetDelivery delivery;
+	switch (id)
+	{
+	// One-off events that must arrive
+	case MSG_CLIENT_READY:
+	case MSG_PLAYER_AUTHORITY:
+	case MSG_NODE_INTEREST:
+		delivery.reliable = true;
+		delivery.inOrder = true;
+		break;
+	// Must arrive, but carries its own sequence
+	case MSG_FLOCK_DROP:
+		delivery.reliable = true;
+		delivery.inOrder = false;
+		break;
+	// Sent every step, only the newest matters
+	case MSG_PLAYER_INPUT:
+	case MSG_PLAYER_STATE:
+		delivery.reliable = false;
+		delivery.inOrder = true;
+		break;
+	// Sequenced per chunk by the flock channel itself
+	default:
+		delivery.reliable = false;
+		delivery.inOrder = false;
+		break;
+	}
+	return delivery;
+}
+
+/// Server's reply to every step of player commands.
+struct PlayerStateMessage
+{
+	static const NetMessageID ID = MSG_PLAYER_STATE;
+
+	/// Newest command applied.
+	unsigned applied;
+	/// Where the commands left the player.
+	Vector3 position;
+	Quaternion rotation;
+};
+
+/// Tells a client which node is its player.
+struct PlayerAuthorityMessage
+{
+	static const NetMessageID ID = MSG_PLAYER_AUTHORITY;
+
+	unsigned nodeID;
+};
+
+/// Send a message already written to buffer, with its type's delivery.
+inline void SendNetMessage(Connection* connection, NetMessageID id, const VectorBuffer& buffer)
+{
+	NetDelivery delivery = GetNetDelivery(id);
+	connection->SendMessage(id, delivery.reliable, delivery.inOrder, buffer);
+}
+
+/// Send a fixed size message as its bytes, through buffer, which is reused rather than allocated per send.
+template <class T> void SendFixedMessage(Connection* connection, const T& message, VectorBuffer& buffer)
+{
+	buffer.Clear();
+	buffer.Write(&message, sizeof(T));
+	SendNetMessage(connection, T::ID, buffer);
+}
+
+/// Read a fixed size message. Returns false if the data is not one.
+template <class T> bool ReadFixedMessage(MemoryBuffer& buffer, T& message)
+{
+	return buffer.GetSize() == sizeof(T) && buffer.Read(&message, sizeof(T)) == sizeof(T);
+}
@@ -0,0 +1,87 @@
+#include <Urho3D/Network/Connection.h>
+#include <Urho3D/Scene/Node.h>
+#include <Urho3D/Scene/SmoothedTransform.h>
+
+#include "PlayerPrediction.h"
+
+PlayerPrediction::PlayerPrediction()
+{
+	Clear();
+}
+
+void PlayerPrediction::Clear()
+{
+	pending.Clear();
+	sequence = 0;
+	acknowledged = 0;
+	hasState = false;
+	position = Vector3::ZERO;
+	rotation = Quaternion::IDENTITY;
+}
+
+void PlayerPrediction::Step(unsigned buttons, float yaw, float timeStep, float viewTime, Connection* server)
+{
+	PlayerCommand command;
+	command.sequence = ++sequence;
+	command.buttons = buttons;
+	command.yaw = yaw;
+	command.viewTime = viewTime;
+	// Sent in whole milliseconds, so predict with what the server will get
+	command.timeStep = Clamp(RoundToInt(timeStep * 1000.0f), 0, 255) / 1000.0f;
+
+	if (pending.Size() == MAX_PENDING_COMMANDS)
+		pending.Erase(0);
+	pending.Push(command);
+	if (hasState)
+		ApplyPlayerControls(command.buttons, command.yaw, command.timeStep, position, rotation);
+
+	unsigned first = pending.Size() - Min(pending.Size(), MAX_INPUT_COMMANDS);
+	message.Clear();
+	message.WriteUInt(pending[first].sequence);
+	message.WriteVLE(pending.Size() - first);
+	// View times as whole milliseconds behind the newest
+	message.WriteFloat(viewTime);
+	for (unsigned i = first; i < pending.Size(); ++i)
+	{
+		message.WriteUShort((unsigned short)pending[i].buttons);
+		message.WriteFloat(pending[i].yaw);
+		message.WriteUByte((unsigned char)RoundToInt(pending[i].timeStep * 1000.0f));
+		message.WriteUShort((unsigned short)Clamp(RoundToInt((viewTime - pending[i].viewTime) * 1000.0f), 0, 65535));
+	}
+	SendNetMessage(server, MSG_PLAYER_INPUT, message);
+}
+
+void PlayerPrediction::HandleState(MemoryBuffer& state)
+{
+	PlayerStateMessage reply;
+	if (!ReadFixedMessage(state, reply))
+		return;
+	// A state behind one already used is a resend or from before a reconnect
+	if (hasState && reply.applied < acknowledged)
+		return;
+
+	acknowledged = reply.applied;
+	unsigned done = 0;
+	while (done < pending.Size() && pending[done].sequence <= reply.applied)
+		++done;
+	pending.Erase(0, done);
+
+	position = reply.position;
+	rotation = reply.rotation;
+	for (unsigned i = 0; i < pending.Size(); ++i)
+		ApplyPlayerControls(pending[i].buttons, pending[i].yaw, pending[i].timeStep, position, rotation);
+	hasState = true;
+}
+
+void PlayerPrediction::Apply(Node* node)
+{
+	if (!hasState)
+		return;
+
+	// Replication still sends the node's transform, the SmoothedTransform takes it in place of the node
+	// and is pointed at the prediction so it never pulls the node back
+	SmoothedTransform* smoothed = node->GetOrCreateComponent<SmoothedTransform>(LOCAL);
+	smoothed->SetTargetPosition(position);
+	smoothed->SetTargetRotation(rotation);
+	node->SetTransform(position, rotation);
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Math/Quaternion.h>
+
+#include "Character.h"
+#include "NetMessages.h"
+
+namespace Urho3D
+{
+	class Connection;
+	class Node;
+}
+
+using namespace Urho3D;
+
+/// Ground speed of a player holding one direction key.
+static const float PLAYER_SPEED = 6.0f;
+/// Longest step a command may move a player for, so a stalled client can't jump ahead.
+static const float MAX_COMMAND_STEP = 0.05f;
+/// Newest unacknowledged commands repeated in every input message, so a lost message costs nothing.
+static const unsigned MAX_INPUT_COMMANDS = 16;
+/// Commands a client keeps while the server is silent, about two seconds of steps.
+/// The server ignores input that skips further ahead of what it has applied.
+static const unsigned MAX_PENDING_COMMANDS = 128;
+
+/// One client physics step of input.
+struct PlayerCommand
+{
+	unsigned sequence;
+	unsigned buttons;
+	float yaw;
+	float timeStep;
+	/// Server flock time the client was showing, which shots are rewound to. Negative before it has shown any.
+	float viewTime;
+};
+
+/// Move a player by one command. The server applies commands with this and clients predict with it,
+/// so both reach the same place from the same start.
+inline void ApplyPlayerControls(unsigned buttons, float yaw, float timeStep, Vector3& position, Quaternion& rotation)
+{
+	rotation = Quaternion(0.0f, yaw, 0.0f);
+	float distance = PLAYER_SPEED * Clamp(timeStep, 0.0f, MAX_COMMAND_STEP);
+	if (buttons & CTRL_FORWARD)
+		position += rotation * Vector3::FORWARD * distance;
+	if (buttons & CTRL_BACK)
+		position += rotation * Vector3::BACK * distance;
+	if (buttons & CTRL_RIGHT)
+		position += rotation * Vector3::RIGHT * distance;
+	if (buttons & CTRL_LEFT)
+		position += rotation * Vector3::LEFT * distance;
+}
+
+/// Client side of the player command channel. Every physics step becomes a numbered command that moves the
+/// player's own node at once and goes to the server with the others it has not acknowledged yet. The server
+/// answers each step with its position and the last command it applied, and the node is put back there with
+/// the commands still in flight replayed on top.
+class PlayerPrediction
+{
+public:
+	PlayerPrediction();
+
+	void Clear();
+	/// Record one step of input, predict its move and send every unacknowledged command.
+	/// viewTime is the server time the client is showing, see FlockSnapshotReceiver::GetShownTime.
+	void Step(unsigned buttons, float yaw, float timeStep, float viewTime, Connection* server);
+	/// Read a MSG_PLAYER_STATE and replay the commands it has not covered from it.
+	void HandleState(MemoryBuffer& message);
+	/// Place the player's own node where it is predicted to be, if the server has placed it yet.
+	void Apply(Node* node);
+
+	/// Commands sent but not yet acknowledged.
+	unsigned GetNumPending() const { return pending.Size(); }
+
+private:
+	/// Commands not yet acknowledged, oldest first.
+	PODVector<PlayerCommand> pending;
+	unsigned sequence;
+	/// Newest command the server has applied.
+	unsigned acknowledged;
+	bool hasState;
+	Vector3 position;
+	Quaternion rotation;
+	VectorBuffer message;
+};
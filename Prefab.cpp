@@ -0,0 +1,85 @@
+#include <Urho3D/Graphics/StaticModel.h>
+#include <Urho3D/Scene/Component.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "Prefab.h"
+
+Prefab::Prefab(Context* context, const String& name) :
+	templateNode(new Node(context))
+{
+	templateNode->SetName(name);
+	templateNode->SetEnabled(false);
+}
+
+void Prefab::Instantiate(Node* parent, unsigned count, CreateMode mode, PODVector<Node*>& nodes) const
+{
+	Scene* scene = parent->GetScene();
+	if (!scene || !count)
+		return;
+
+	const Vector<SharedPtr<Component> >& components = templateNode->GetComponents();
+	const String& name = templateNode->GetName();
+	bool enabled = templateNode->IsEnabled();
+	unsigned firstID = ReserveNodeIDs(scene, count, mode);
+
+	nodes.Reserve(nodes.Size() + count);
+	for (unsigned i = 0; i < count; ++i)
+	{
+		Node* node = parent->CreateChild(name, mode, firstID + i);
+		// Before any component exists, so a disabled clone's body is never added to the physics world
+		node->SetEnabled(enabled);
+		node->SetTransform(templateNode->GetPosition(), templateNode->GetRotation(), templateNode->GetScale());
+		for (unsigned j = 0; j < components.Size(); ++j)
+			CloneComponent(node, components[j], mode);
+		nodes.Push(node);
+	}
+}
+
+Component* Prefab::CloneComponent(Node* node, Component* source, CreateMode mode)
+{
+	if (source->GetType() != StaticModel::GetTypeStatic())
+		return node->CloneComponent(source, mode);
+
+	StaticModel* model = static_cast<StaticModel*>(source);
+	StaticModel* clone = static_cast<StaticModel*>(node->CreateComponent(StaticModel::GetTypeStatic(), mode));
+	if (!clone)
+		return nullptr;
+
+	// The model first, it sizes the material list
+	clone->SetModel(model->GetModel());
+
+	// Every other saved attribute as Node::CloneComponent copies them, resource references are what the pointers replace
+	const Vector<AttributeInfo>* attributes = model->GetAttributes();
+	const Vector<AttributeInfo>* cloneAttributes = clone->GetAttributes();
+	for (unsigned i = 0; attributes && cloneAttributes && i < attributes->Size() && i < cloneAttributes->Size(); ++i)
+	{
+		const AttributeInfo& attr = (*attributes)[i];
+		if (!(attr.mode_ & AM_FILE) || attr.type_ == VAR_RESOURCEREF || attr.type_ == VAR_RESOURCEREFLIST)
+			continue;
+		Variant value;
+		model->OnGetAttribute(attr, value);
+		clone->OnSetAttribute((*cloneAttributes)[i], value);
+	}
+
+	for (unsigned i = 0; i < model->GetNumGeometries(); ++i)
+		clone->SetMaterial(i, model->GetMaterial(i));
+	clone->ApplyAttributes();
+	return clone;
+}
+
+unsigned Prefab::ReserveNodeIDs(Scene* scene, unsigned count, CreateMode mode)
+{
+	// Usually the first free ID starts a free block, otherwise move past whatever is in the way
+	unsigned firstID = scene->GetFreeNodeID(mode);
+	for (unsigned i = 0; i < count;)
+	{
+		if (scene->GetNode(firstID + i))
+		{
+			firstID += i + 1;
+			i = 0;
+		}
+		else
+			++i;
+	}
+	return firstID;
+}
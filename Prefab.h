@@ -0,0 +1,29 @@
+#pragma once
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Scene/Node.h>
+
+using namespace Urho3D;
+
+/// A node template cloned many times in one call, for scene setup.
+/// Components are added to the template and configured once, with their resources already resolved,
+/// then Instantiate copies the template's attributes into each clone instead of running setup code per node.
+/// A StaticModel's model and materials are handed to each clone as the template's pointers, not looked up by name again.
+/// The template starts disabled, so clones never enter the physics world or octree until they are enabled.
+class Prefab
+{
+public:
+	Prefab(Context* context, const String& name);
+
+	/// Detached node to add the template's components to.
+	Node* GetTemplate() const { return templateNode; }
+	/// Create count clones under parent, with consecutive node IDs reserved in one block, and append them to nodes.
+	void Instantiate(Node* parent, unsigned count, CreateMode mode, PODVector<Node*>& nodes) const;
+
+private:
+	/// Clone one template component into node. Like Node::CloneComponent, except for the StaticModel resources.
+	static Component* CloneComponent(Node* node, Component* source, CreateMode mode);
+	/// First of count consecutive node IDs that are all free in scene.
+	static unsigned ReserveNodeIDs(Scene* scene, unsigned count, CreateMode mode);
+
+	SharedPtr<Node> templateNode;
+};